@@ -0,0 +1,41 @@
+#!/bin/sh
+# Stand-in for the package managers of every distro, run through the
+# local:// backend. It's called under the name of the real tool and answers
+# searches in that tool's output format after BENCH_LATENCY seconds.
+
+sleep "${BENCH_LATENCY:-0.01}"
+
+# The search pattern is the last argument, reduced to the library name
+pattern=$(eval echo "\${$#}")
+name=$(echo "$pattern" | sed 's/^\^//; s/\$$//; s/^lib//; s/\.\*-dev$//; s/-devel$//; s/-dev$//')
+
+case $(basename "$0") in
+    apt-cache)
+        echo "lib$name-dev - $name development files"
+        echo "lib$name-doc-dev - $name documentation"
+        ;;
+    pacman)
+        echo "extra/$name 1.0-1"
+        echo "    $name library"
+        ;;
+    apk)
+        echo "$name-dev-1.0-r0 - $name development files"
+        ;;
+    dnf)
+        echo "Last metadata expiration check: 0:01:00 ago."
+        echo "$name-devel.x86_64 : $name development files"
+        ;;
+    emerge)
+        echo "*  dev-libs/$name"
+        echo "      Latest version available: 1.0"
+        echo "      dev-libs/$name"
+        ;;
+    zypper)
+        echo "S | Name | Summary | Type"
+        echo "  | lib$name-devel | $name development files | package"
+        ;;
+    *)
+        echo "fakepm: unknown tool $(basename "$0")" >&2
+        exit 127
+        ;;
+esac
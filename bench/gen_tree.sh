@@ -0,0 +1,72 @@
+#!/bin/sh
+# Generate a synthetic source tree for benchmarking
+#
+# Usage: gen_tree.sh <dir>
+#
+# Size comes from the environment:
+#   BENCH_FILES      C files (default 2000)
+#   BENCH_INCLUDES   #include lines per file (default 10)
+#   BENCH_HEADERS    Distinct system headers (default 100)
+#   BENCH_DEPTH      Directory depth (default 3)
+#   BENCH_MAKEFILES  Makefiles with -l flags (default 20)
+
+set -e
+
+dir=$1
+if [ -z "$dir" ]; then
+    echo "Usage: $0 <dir>" >&2
+    exit 1
+fi
+
+files=${BENCH_FILES:-2000}
+includes=${BENCH_INCLUDES:-10}
+headers=${BENCH_HEADERS:-100}
+depth=${BENCH_DEPTH:-3}
+makefiles=${BENCH_MAKEFILES:-20}
+
+rm -rf "$dir"
+mkdir -p "$dir"
+
+# Files go 8 per directory level, so every depth gets used
+awk -v dir="$dir" -v files="$files" -v includes="$includes" -v headers="$headers" \
+    -v depth="$depth" -v makefiles="$makefiles" '
+function subdir(i,    path, k, n) {
+    path = dir
+    n = int(i / 8)
+    for (k = 0; k < depth; k++) {
+        path = path "/d" (n % 8)
+        n = int(n / 8)
+    }
+    return path
+}
+
+BEGIN {
+    srand(1)
+    for (i = 0; i < files; i++) {
+        path = subdir(i)
+        if (!(path in made)) {
+            system("mkdir -p \"" path "\"")
+            made[path] = 1
+        }
+
+        out = path "/f" i ".c"
+        printf "// Generated file %d\n\n", i > out
+        for (j = 0; j < includes; j++)
+            printf "#include <bench%d.h>\n", int(rand() * headers) > out
+        printf "#include \"local%d.h\"\n\n", i % 10 > out
+        printf "static int value%d = %d;\n\n", i, i > out
+        printf "int function%d(int x) {\n", i > out
+        printf "    // # not a directive\n" > out
+        printf "    return x * value%d + %d;\n}\n", i, j > out
+        close(out)
+    }
+
+    for (i = 0; i < makefiles; i++) {
+        path = subdir(i * (files / (makefiles ? makefiles : 1)))
+        out = path "/Makefile"
+        printf "CFLAGS = -O2 -Wall\n" > out
+        printf "LIBS = -lbench%d -lbench%d\n\n", int(rand() * headers), int(rand() * headers) > out
+        printf "all:\n\t$(CC) $(CFLAGS) *.c $(LIBS)\n" > out
+        close(out)
+    }
+}'
@@ -0,0 +1,115 @@
+#!/bin/sh
+# Benchmark distro-dep-name on a synthetic tree, with fake package managers
+# answering every distro's queries through the local:// backend
+#
+# Usage: run.sh [--record]
+#
+#   --record         Save the results as the new baseline
+#
+# Environment:
+#   BENCH_RUNS       Runs to keep the best of (default 3)
+#   BENCH_LATENCY    Seconds each package manager query takes (default 0.01)
+#   BENCH_TOLERANCE  Percentage a metric can get worse by before being
+#                    flagged (default 10)
+#   BENCH_BASELINE   Baseline file (default bench/baseline.txt)
+#   BENCH_FAIL       Exit with status 1 on regressions when set to 1
+#   See gen_tree.sh for the size of the tree
+
+set -e
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+bin=$root/distro-dep-name
+baseline=${BENCH_BASELINE:-$root/bench/baseline.txt}
+runs=${BENCH_RUNS:-3}
+tolerance=${BENCH_TOLERANCE:-10}
+
+if [ ! -x "$bin" ]; then
+    echo "Error: build $bin first" >&2
+    exit 1
+fi
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/ddn-bench-XXXXXX")
+trap 'rm -rf "$work"' EXIT
+
+mkdir -p "$work/bin"
+for tool in apt-cache pacman apk dnf emerge zypper; do
+    ln -s "$root/bench/fakepm.sh" "$work/bin/$tool"
+done
+
+echo "Generating tree..."
+"$root/bench/gen_tree.sh" "$work/tree"
+
+# Nothing from the user's environment: no cache, no index, local "VMs"
+export PATH="$work/bin:$PATH"
+export XDG_CACHE_HOME="$work/cache" XDG_DATA_HOME="$work/data"
+for distro in $("$bin" -l | tail -n +2); do
+    export DISTRO_VM_$distro=local://
+done
+
+# One run, writes "<metric> <value>" lines
+run_once() {
+    start=$(date +%s%N)
+    "$bin" --no-cache --index-dir "$work/index" --stats --trace "$work/trace.json" \
+        "$work/tree" >/dev/null 2>"$work/stats.txt"
+    end=$(date +%s%N)
+
+    awk '$1 == "walk" || $1 == "parse" { ms += $3 }
+         $1 == "files" && $2 == "scanned" { files = $3 }
+         END {
+             printf "parse_ms %.3f\n", ms
+             if (ms > 0) printf "parse_files_per_sec %.0f\n", files * 1000 / ms
+         }' "$work/stats.txt"
+
+    # Distro spans of the trace, one event per line
+    sed -n 's/.*"name":"distro".*"dur":\([0-9.]*\).*"detail":"\([^"]*\)".*/\2 \1/p' "$work/trace.json" |
+        awk '{ printf "distro_%s_ms %.3f\n", $1, $2 / 1000 }'
+
+    echo "end_to_end_ms $(( (end - start) / 1000000 ))"
+}
+
+echo "Running $runs times..."
+: > "$work/runs.txt"
+i=0
+while [ $i -lt "$runs" ]; do
+    run_once >> "$work/runs.txt"
+    i=$((i + 1))
+done
+
+# Best of the runs: highest throughput, lowest times
+awk '{
+         if (!($1 in best)) { best[$1] = $2; order[n++] = $1 }
+         else if ($1 ~ /_per_sec$/ ? $2 > best[$1] : $2 < best[$1]) best[$1] = $2
+     }
+     END { for (i = 0; i < n; i++) print order[i], best[order[i]] }' "$work/runs.txt" > "$work/current.txt"
+
+if [ "$1" = "--record" ]; then
+    cp "$work/current.txt" "$baseline"
+    echo "Baseline saved to $baseline"
+    cat "$baseline"
+    exit 0
+fi
+
+touch "$work/baseline.txt"
+[ -f "$baseline" ] && cp "$baseline" "$work/baseline.txt"
+
+status=0
+awk -v tolerance="$tolerance" '
+    NR == FNR { base[$1] = $2; next }
+    FNR == 1 { printf "%-28s %12s %12s %9s\n", "metric", "current", "baseline", "change" }
+    {
+        if (!($1 in base) || base[$1] == 0) {
+            printf "%-28s %12s %12s %9s\n", $1, $2, "-", "-"
+            next
+        }
+        change = ($2 - base[$1]) * 100 / base[$1]
+        worse = $1 ~ /_per_sec$/ ? -change : change
+        flag = worse > tolerance ? "  REGRESSION" : ""
+        if (flag) regressions++
+        printf "%-28s %12s %12s %+8.1f%%%s\n", $1, $2, base[$1], change, flag
+    }
+    END { exit regressions > 0 }' "$work/baseline.txt" "$work/current.txt" || status=1
+
+if [ $status -ne 0 ] && [ "${BENCH_FAIL:-0}" = 1 ]; then
+    exit 1
+fi
+exit 0
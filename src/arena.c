@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+#include "arena.h"
+
+#define ARENA_BLOCK_SIZE 65536
+
+struct arena_block {
+    arena_block_t *next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) char data[];
+};
+
+// Take 'size' bytes at an 'align' boundary from the current block,
+// or from a new one
+static void* arena_bump(arena_t *arena, size_t size, size_t align) {
+    arena_block_t *block = arena->blocks;
+    size_t offset = block ? (block->used + align - 1) & ~(align - 1) : 0;
+
+    if (!block || offset > block->size || block->size - offset < size) {
+        // Large allocations get a block of their own, behind the current one
+        // so that its free space isn't lost
+        size_t block_size = size > ARENA_BLOCK_SIZE / 4 ? size : ARENA_BLOCK_SIZE;
+        arena_block_t *fresh = malloc(sizeof(arena_block_t) + block_size);
+        if (!fresh) return NULL;
+        fresh->size = block_size;
+        fresh->used = 0;
+
+        if (block && block_size != ARENA_BLOCK_SIZE) {
+            fresh->next = block->next;
+            block->next = fresh;
+        } else {
+            fresh->next = block;
+            arena->blocks = fresh;
+        }
+        block = fresh;
+        offset = 0;
+    }
+
+    block->used = offset + size;
+    return block->data + offset;
+}
+
+void* arena_alloc(arena_t *arena, size_t size) {
+    return arena_bump(arena, size, alignof(max_align_t));
+}
+
+// Strings need no alignment and are packed
+char* arena_strndup(arena_t *arena, const char *str, size_t len) {
+    char *copy = arena_bump(arena, len + 1, 1);
+    if (!copy) return NULL;
+
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+char* arena_strdup(arena_t *arena, const char *str) {
+    return arena_strndup(arena, str, strlen(str));
+}
+
+void arena_free(arena_t *arena) {
+    arena_block_t *block = arena->blocks;
+    while (block) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+}
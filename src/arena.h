@@ -0,0 +1,26 @@
+#ifndef ARENA_H
+#define ARENA_H 1
+
+#include <stddef.h>
+
+typedef struct arena_block arena_block_t;
+
+// Bump-pointer allocator: allocations come out of large blocks and are only
+// released all at once by arena_free(). Not thread-safe, each thread or
+// list has its own. A zeroed arena_t is an empty arena.
+typedef struct {
+    arena_block_t *blocks;      // Newest first, allocations come from the first one
+} arena_t;
+
+// Allocate 'size' bytes aligned for any type, NULL on failure
+void* arena_alloc(arena_t *arena, size_t size);
+
+// Copy 'len' bytes of a string and NUL-terminate the copy
+char* arena_strndup(arena_t *arena, const char *str, size_t len);
+
+char* arena_strdup(arena_t *arena, const char *str);
+
+// Release every allocation, the arena can be used again afterwards
+void arena_free(arena_t *arena);
+
+#endif // ARENA_H
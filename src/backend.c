@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include "ddn_config.h"
+#include "backend.h"
+#include "stats.h"
+
+#define READ_BUFFER_LEN 8192
+#define CONTROL_PERSIST_SECS 60
+#define BACKEND_MAX_ERRORS 4096
+#define CANCEL_POLL_MS 50
+
+extern char **environ;
+
+// Scheme prefixes of DISTRO_VM_<name> values
+static const struct {
+    const char *scheme;
+    backend_type_t type;
+} schemes[] = {
+    { "ssh://", BACKEND_SSH },
+    { "podman://", BACKEND_PODMAN },
+    { "docker://", BACKEND_DOCKER },
+    { "local://", BACKEND_LOCAL },
+    { "chroot://", BACKEND_CHROOT },
+    { "nspawn://", BACKEND_NSPAWN },
+};
+
+// Quote a string for the target's shell
+char* shell_quote(const char *str) {
+    size_t len = 3;
+    for (const char *p = str; *p; p++)
+        len += (*p == '\'') ? 4 : 1;
+
+    char *quoted = malloc(len);
+    if (!quoted) return NULL;
+
+    char *q = quoted;
+    *q++ = '\'';
+    for (const char *p = str; *p; p++) {
+        if (*p == '\'') {
+            memcpy(q, "'\\''", 4);
+            q += 4;
+        } else {
+            *q++ = *p;
+        }
+    }
+    *q++ = '\'';
+    *q = '\0';
+
+    return quoted;
+}
+
+// Run an ssh control command with no local shell and nothing on the
+// terminal, returns its exit status or -1 if it couldn't be started
+static int run_ssh_control(const char *caller, const char *const *argv) {
+    if (config.debug) {
+        printf("ddn:%s(): running", caller);
+        for (int i = 0; argv[i]; i++) {
+            printf(" %s", argv[i]);
+        }
+        printf("\n");
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    pid_t pid;
+    int ret = posix_spawnp(&pid, argv[0], &actions, NULL, (char* const*)argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (ret != 0) {
+        if (config.debug)
+            printf("ddn:%s(): cannot run '%s': %s\n", caller, argv[0], strerror(ret));
+        return -1;
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Open a persistent SSH control connection so that every following query
+// only opens a new channel instead of doing a full handshake.
+// If the master can't be started, commands fall back to plain connections.
+static void open_ssh_master(backend_t *backend) {
+    const char *tmpdir = getenv("TMPDIR");
+    if (!tmpdir || strlen(tmpdir) > 64) tmpdir = "/tmp";
+
+    char dir_template[128];
+    snprintf(dir_template, sizeof(dir_template), "%s/ddn-XXXXXX", tmpdir);
+    if (!mkdtemp(dir_template)) {
+        if (config.debug)
+            printf("ddn:open_ssh_master(): mkdtemp() failed: %s\n", strerror(errno));
+        return;
+    }
+    backend->control_dir = strdup(dir_template);
+    snprintf(backend->control_path, sizeof(backend->control_path), "%s/ctl", dir_template);
+    snprintf(backend->control_option, sizeof(backend->control_option),
+             "ControlPath=%s", backend->control_path);
+
+    // ControlPersist keeps the master alive in the background and makes it
+    // exit by itself if we never get to close it
+    char persist_option[32];
+    snprintf(persist_option, sizeof(persist_option), "ControlPersist=%d", CONTROL_PERSIST_SECS);
+    const char *argv[] = {
+        "ssh", "-o", "ControlMaster=yes", "-o", backend->control_option, "-o", persist_option,
+        "-f", "-N", "--", backend->target, NULL
+    };
+
+    if (run_ssh_control("open_ssh_master", argv) != 0) {
+        if (config.debug)
+            printf("ddn:open_ssh_master(): master connection to '%s' failed\n", backend->target);
+        rmdir(backend->control_dir);
+        free(backend->control_dir);
+        backend->control_dir = NULL;
+        backend->control_path[0] = '\0';
+    }
+}
+
+// Stop the control master and remove its socket directory
+static void close_ssh_master(backend_t *backend) {
+    const char *argv[] = {
+        "ssh", "-o", backend->control_option, "-O", "exit", "--", backend->target, NULL
+    };
+
+    if (run_ssh_control("close_ssh_master", argv) != 0 && config.debug)
+        printf("ddn:close_ssh_master(): 'ssh -O exit' failed\n");
+
+    unlink(backend->control_path);
+    rmdir(backend->control_dir);
+    free(backend->control_dir);
+}
+
+// Set the arguments every command gets appended to
+static void set_args(backend_t *backend) {
+    const char **args = backend->args;
+    int n = 0;
+
+    switch (backend->type) {
+        case BACKEND_SSH:
+            args[n++] = "ssh";
+            if (backend->control_dir) {
+                args[n++] = "-o";
+                args[n++] = backend->control_option;
+            }
+            args[n++] = backend->target;
+            args[n++] = "--";
+            break;
+        case BACKEND_PODMAN:
+        case BACKEND_DOCKER:
+            args[n++] = backend->type == BACKEND_PODMAN ? "podman" : "docker";
+            args[n++] = "exec";
+            args[n++] = "-i";
+            args[n++] = backend->target;
+            break;
+        case BACKEND_LOCAL:
+            break;
+        case BACKEND_CHROOT:
+            args[n++] = "chroot";
+            args[n++] = backend->target;
+            break;
+        case BACKEND_NSPAWN:
+            args[n++] = "systemd-nspawn";
+            args[n++] = "-q";
+            args[n++] = "--pipe";
+            args[n++] = "-D";
+            args[n++] = backend->target;
+            break;
+    }
+
+    // ssh hands the command to the remote user's shell, the others need one
+    if (backend->type != BACKEND_SSH) {
+        args[n++] = "sh";
+        args[n++] = "-c";
+    }
+
+    backend->arg_count = n;
+}
+
+backend_t* backend_open(const char *spec) {
+    backend_t *backend = calloc(1, sizeof(backend_t));
+    if (!backend) return NULL;
+
+    // No scheme is an SSH host
+    backend->type = BACKEND_SSH;
+    const char *target = spec;
+    for (size_t i = 0; i < sizeof(schemes) / sizeof(schemes[0]); i++) {
+        size_t len = strlen(schemes[i].scheme);
+        if (strncmp(spec, schemes[i].scheme, len) == 0) {
+            backend->type = schemes[i].type;
+            target = spec + len;
+            break;
+        }
+    }
+
+    if (config.debug)
+        printf("ddn:backend_open(): '%s' is backend %d, target '%s'\n", spec, backend->type, target);
+
+    backend->target = strdup(target);
+    if (!backend->target) {
+        free(backend);
+        return NULL;
+    }
+
+    if (backend->type == BACKEND_SSH)
+        open_ssh_master(backend);
+
+    set_args(backend);
+
+    return backend;
+}
+
+void backend_close(backend_t *backend) {
+    if (!backend) return;
+
+    if (backend->control_dir)
+        close_ssh_master(backend);
+
+    free(backend->target);
+    free(backend);
+}
+
+// Keep the start of the command's error output
+static void add_errors(char *errors, size_t *len, const char *data, size_t size) {
+    if (*len + size > BACKEND_MAX_ERRORS) size = BACKEND_MAX_ERRORS - *len;
+    memcpy(errors + *len, data, size);
+    *len += size;
+}
+
+// Start the command with its output and errors going to pipes,
+// no local shell is involved
+static pid_t spawn_command(backend_t *backend, const char *command, int *out_fd, int *err_fd) {
+    const char *argv[BACKEND_MAX_ARGS + 2];
+    memcpy(argv, backend->args, backend->arg_count * sizeof(char*));
+    argv[backend->arg_count] = command;
+    argv[backend->arg_count + 1] = NULL;
+
+    // Close-on-exec keeps the pipes of one thread's command out of the
+    // commands started by the other threads
+    int out_pipe[2], err_pipe[2];
+    if (pipe2(out_pipe, O_CLOEXEC) != 0) return -1;
+    if (pipe2(err_pipe, O_CLOEXEC) != 0) {
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err_pipe[1], STDERR_FILENO);
+
+    pid_t pid;
+    int ret = posix_spawnp(&pid, argv[0], &actions, NULL, (char* const*)argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+
+    if (ret != 0) {
+        if (config.debug)
+            printf("ddn:spawn_command(): cannot run '%s': %s\n", argv[0], strerror(ret));
+        close(out_pipe[0]);
+        close(err_pipe[0]);
+        return -1;
+    }
+
+    *out_fd = out_pipe[0];
+    *err_fd = err_pipe[0];
+    return pid;
+}
+
+// How long poll() may wait before the deadline or the cancel flag need a look,
+// 0 once the command has to be stopped and -1 for as long as it takes
+static int poll_timeout(long long deadline, atomic_int *cancel) {
+    if (cancel && atomic_load(cancel)) return 0;
+
+    int timeout = cancel ? CANCEL_POLL_MS : -1;
+    if (deadline) {
+        long long remaining = deadline - stats_now();
+        if (remaining <= 0) return 0;
+        long long ms = (remaining + 999999) / 1000000;
+        if (timeout < 0 || ms < timeout) timeout = ms > INT_MAX ? INT_MAX : (int)ms;
+    }
+    return timeout;
+}
+
+int backend_run(backend_t *backend, const char *command, line_fn_t fn, void *arg, char **errors) {
+    return backend_run_until(backend, command, fn, arg, errors, 0, NULL);
+}
+
+// Execute a command and pass its output to 'fn' line by line as it
+// arrives. Only the line being received is buffered, whatever the output size.
+int backend_run_until(backend_t *backend, const char *command, line_fn_t fn, void *arg,
+                      char **errors, long long deadline, atomic_int *cancel) {
+    if (config.debug)
+        printf("ddn:backend_run_until(): (subdir) running '%s'\n", command);
+
+    if (errors) *errors = NULL;
+
+    size_t capacity = READ_BUFFER_LEN;
+    char *buffer = malloc(capacity);
+    char *error_buffer = malloc(BACKEND_MAX_ERRORS + 1);
+    if (!buffer || !error_buffer) {
+        free(buffer);
+        free(error_buffer);
+        return -1;
+    }
+
+    long long start = stats_begin();
+    stats_add(STAT_REMOTE_COMMANDS, 1);
+
+    int out_fd, err_fd;
+    pid_t pid = spawn_command(backend, command, &out_fd, &err_fd);
+    if (pid < 0) {
+        free(buffer);
+        free(error_buffer);
+        return -1;
+    }
+
+    // Both pipes are read together so that a command writing a lot of
+    // errors can't block. Complete lines are handed out and the partial
+    // one moves to the front of the buffer.
+    struct pollfd fds[2] = {
+        { .fd = out_fd, .events = POLLIN },
+        { .fd = err_fd, .events = POLLIN },
+    };
+    size_t len = 0;
+    size_t error_len = 0;
+    int killed = 0;
+    while (fds[0].fd >= 0 || fds[1].fd >= 0) {
+        // A stuck command is killed rather than waited for, commands it
+        // started get EPIPE once the pipes are closed
+        int timeout = poll_timeout(deadline, cancel);
+        if (timeout == 0) {
+            killed = cancel && atomic_load(cancel) ? BACKEND_CANCELLED : BACKEND_TIMED_OUT;
+            kill(pid, SIGKILL);
+            break;
+        }
+
+        int ready = poll(fds, 2, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (ready == 0) continue;
+
+        if (fds[1].revents) {
+            char chunk[1024];
+            ssize_t nread = read(err_fd, chunk, sizeof(chunk));
+            if (nread > 0) {
+                add_errors(error_buffer, &error_len, chunk, nread);
+            } else if (nread == 0 || errno != EINTR) {
+                fds[1].fd = -1;
+            }
+        }
+
+        if (!fds[0].revents) continue;
+
+        ssize_t nread = read(out_fd, buffer + len, capacity - len - 1);
+        if (nread <= 0) {
+            if (nread == 0 || errno != EINTR) fds[0].fd = -1;
+            continue;
+        }
+
+        size_t scanned = len;
+        len += nread;
+
+        char *start = buffer;
+        char *newline;
+        while ((newline = memchr(buffer + scanned, '\n', len - scanned))) {
+            *newline = '\0';
+            fn(start, arg);
+            start = newline + 1;
+            scanned = start - buffer;
+        }
+
+        len -= start - buffer;
+        memmove(buffer, start, len);
+
+        // A line longer than the buffer
+        if (len + 1 >= capacity) {
+            char *tmp = realloc(buffer, capacity * 2);
+            if (!tmp) break;
+            buffer = tmp;
+            capacity *= 2;
+        }
+    }
+
+    // Last line without a newline
+    if (len > 0 && !killed) {
+        buffer[len] = '\0';
+        fn(buffer, arg);
+    }
+
+    close(out_fd);
+    close(err_fd);
+
+    int status = -1;
+    int wstatus;
+    while (waitpid(pid, &wstatus, 0) < 0) {
+        if (errno != EINTR) break;
+    }
+    if (killed) {
+        status = killed;
+    } else if (WIFEXITED(wstatus)) {
+        status = WEXITSTATUS(wstatus);
+    } else if (WIFSIGNALED(wstatus)) {
+        status = 128 + WTERMSIG(wstatus);
+    }
+
+    stats_end(SPAN_COMMAND, start, command);
+
+    error_buffer[error_len] = '\0';
+    if (config.debug && (status != 0 || error_len > 0))
+        printf("ddn:backend_run_until(): exit status %d, errors '%s'\n", status, error_buffer);
+
+    if (errors && error_len > 0) {
+        *errors = error_buffer;
+    } else {
+        free(error_buffer);
+    }
+
+    free(buffer);
+    return status;
+}
@@ -0,0 +1,57 @@
+#ifndef BACKEND_H
+#define BACKEND_H 1
+
+#include <stdatomic.h>
+
+// Where a distro's commands run, from the scheme of DISTRO_VM_<name>
+typedef enum {
+    BACKEND_SSH,        // user@host or ssh://user@host
+    BACKEND_PODMAN,     // podman://container
+    BACKEND_DOCKER,     // docker://container
+    BACKEND_LOCAL,      // local://
+    BACKEND_CHROOT,     // chroot:///path/to/rootfs
+    BACKEND_NSPAWN      // nspawn:///path/to/rootfs
+} backend_type_t;
+
+#define BACKEND_MAX_ARGS 8
+
+// Open connection to a distro's system, shared by all its commands
+typedef struct {
+    backend_type_t type;
+    char *target;               // Host, container or root directory
+    const char *args[BACKEND_MAX_ARGS];  // Program and arguments run with each command
+    int arg_count;
+    char *control_dir;          // SSH control master socket directory
+    char control_path[256];
+    char control_option[280];
+} backend_t;
+
+// Called for each line of command output, without the newline
+typedef void (*line_fn_t)(char *line, void *arg);
+
+// Connect to the system described by a DISTRO_VM_<name> value
+backend_t* backend_open(const char *spec);
+
+// Run a shell command on the target and pass its output to 'fn' line by line
+// as it arrives. Returns the exit status, 128 + signal number if it was killed,
+// or -1 if it couldn't be started. The start of its error output goes to
+// 'errors' when given, NULL if there was none.
+int backend_run(backend_t *backend, const char *command, line_fn_t fn, void *arg, char **errors);
+
+// Exit status of commands killed before they finished
+#define BACKEND_TIMED_OUT -2    // The deadline passed
+#define BACKEND_CANCELLED -3    // The cancel flag got set
+
+// Like backend_run(), but the command is killed once 'deadline' passes
+// (a stats_now() time, 0 for none) or as soon as '*cancel' becomes non-zero
+// when given. The output of a killed command stops at its last complete line.
+int backend_run_until(backend_t *backend, const char *command, line_fn_t fn, void *arg,
+                      char **errors, long long deadline, atomic_int *cancel);
+
+// Close the connection and free the backend
+void backend_close(backend_t *backend);
+
+// Quote a string for the target's shell
+char* shell_quote(const char *str);
+
+#endif // BACKEND_H
@@ -0,0 +1,458 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "ddn_config.h"
+#include "buildfiles.h"
+
+#define MAX_NAME_LEN 256
+
+// Separators of the words in module lists
+#define WORD_SEPARATORS " \t\r\n\\,[]\"'"
+
+// CMake find_package() names with their pkg-config module,
+// NULL for packages that aren't libraries
+static const struct {
+    const char *package;
+    const char *module;
+} cmake_packages[] = {
+    { "BZip2", "bzip2" },
+    { "CURL", "libcurl" },
+    { "Curses", "ncurses" },
+    { "EXPAT", "expat" },
+    { "Freetype", "freetype2" },
+    { "GnuTLS", "gnutls" },
+    { "GTest", "gtest" },
+    { "JPEG", "libjpeg" },
+    { "LibArchive", "libarchive" },
+    { "LibLZMA", "liblzma" },
+    { "LibXml2", "libxml-2.0" },
+    { "OpenGL", "gl" },
+    { "OpenSSL", "openssl" },
+    { "PNG", "libpng" },
+    { "PostgreSQL", "libpq" },
+    { "Protobuf", "protobuf" },
+    { "SDL2", "sdl2" },
+    { "SQLite3", "sqlite3" },
+    { "TIFF", "libtiff-4" },
+    { "X11", "x11" },
+    { "ZLIB", "zlib" },
+    { "Doxygen", NULL },
+    { "Git", NULL },
+    { "OpenMP", NULL },
+    { "Perl", NULL },
+    { "PkgConfig", NULL },
+    { "Python", NULL },
+    { "Python3", NULL },
+    { "Threads", NULL },
+};
+
+// Meson dependencies that come with the compiler
+static const char *meson_builtin[] = { "threads", "openmp", "dl" };
+
+typedef enum {
+    COMMENT_MAKE,       // '#', unless escaped
+    COMMENT_CMAKE,      // '#' outside "strings"
+    COMMENT_MESON,      // '#' outside 'strings'
+    COMMENT_M4          // '#' and dnl
+} comment_style_t;
+
+static int is_word_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static void add_found(dependency_list_t *list, const char *name, size_t len, dependency_type_t type) {
+    if (len == 0 || len >= MAX_NAME_LEN) return;
+
+    char buffer[MAX_NAME_LEN];
+    memcpy(buffer, name, len);
+    buffer[len] = '\0';
+
+    if (config.debug) {
+        const char *what = type == DEP_TYPE_PKGCONFIG ? "pkg-config module" :
+                           type == DEP_TYPE_DEFINE ? "define" : "library";
+        printf("  found %s '%s'\n", what, buffer);
+    }
+    add_dependency(list, buffer, type);
+}
+
+// Copy the file contents with comments blanked out, newlines are kept
+static char* strip_comments(const char *data, size_t size, comment_style_t style) {
+    char *text = malloc(size + 1);
+    if (!text) return NULL;
+    memcpy(text, data, size);
+    text[size] = '\0';
+
+    char quote = style == COMMENT_CMAKE ? '"' : style == COMMENT_MESON ? '\'' : 0;
+    int in_string = 0;
+    for (char *p = text; *p; p++) {
+        if (quote && *p == quote && (p == text || p[-1] != '\\')) {
+            in_string = !in_string;
+            continue;
+        }
+        if (in_string) {
+            if (*p == '\n') in_string = 0;
+            continue;
+        }
+
+        int comment = *p == '#' && !(style == COMMENT_MAKE && p > text && p[-1] == '\\');
+        if (style == COMMENT_M4 && strncmp(p, "dnl", 3) == 0 &&
+            (p == text || !is_word_char(p[-1])) && !is_word_char(p[3]))
+            comment = 1;
+
+        if (comment) {
+            while (*p && *p != '\n') *p++ = ' ';
+            if (!*p) break;
+        }
+    }
+
+    return text;
+}
+
+// Add the modules of a list like "glib-2.0 >= 2.50 gio-2.0", version
+// constraints are skipped. With 'skip_keywords', all-uppercase words
+// (CMake's REQUIRED, QUIET...) are skipped too.
+static void add_module_list(dependency_list_t *list, const char *p, const char *end, int skip_keywords) {
+    int skip_version = 0;
+
+    while (p < end) {
+        p += strspn(p, WORD_SEPARATORS);
+        if (p >= end) break;
+        size_t len = strcspn(p, WORD_SEPARATORS);
+        if (p + len > end) len = end - p;
+        const char *word = p;
+        p += len;
+
+        // A version after a separate operator
+        if (skip_version) {
+            skip_version = 0;
+            continue;
+        }
+        if (strspn(word, "<>=!") >= len) {
+            skip_version = 1;
+            continue;
+        }
+
+        // Options, variables and versions
+        if (*word == '-' || *word == '$' || *word == '@' || isdigit((unsigned char)*word))
+            continue;
+
+        if (skip_keywords) {
+            size_t upper = 0;
+            while (upper < len && (isupper((unsigned char)word[upper]) || word[upper] == '_')) upper++;
+            if (upper == len) continue;
+        }
+
+        // "name>=version"
+        size_t name_len = strcspn(word, "<>=!");
+        if (name_len > len) name_len = len;
+        add_found(list, word, name_len, DEP_TYPE_PKGCONFIG);
+    }
+}
+
+// Add the modules of pkg-config invocations: "pkg-config --libs foo",
+// "$(PKG_CONFIG) --cflags foo" and the like, up to the end of the command
+static void scan_pkg_config_calls(const char *text, dependency_list_t *list) {
+    static const char *names[] = { "pkg-config", "PKG_CONFIG" };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        size_t name_len = strlen(names[i]);
+        for (const char *p = text; (p = strstr(p, names[i])); p += name_len) {
+            const char *after = p + name_len;
+            if (p > text && (is_word_char(p[-1]) || p[-1] == '-')) continue;
+            if (is_word_char(*after) || *after == '-' || *after == '.') continue;
+
+            // The variable only counts when expanded
+            if (i == 1) {
+                if (p == text || (p[-1] != '$' && p[-1] != '(' && p[-1] != '{')) continue;
+                if (*after == ')' || *after == '}') after++;
+            }
+
+            // The command ends at the end of the line, of the expansion
+            // or of the shell command
+            const char *end = after;
+            while (*end && !strchr(")`;|&\"}", *end)) {
+                if (*end == '\n' && end[-1] != '\\') break;
+                end++;
+            }
+
+            add_module_list(list, after, end, 0);
+        }
+    }
+}
+
+// Add the -D flags starting a word: "-DNAME" or "-DNAME=VALUE"
+static void scan_define_flags(const char *text, dependency_list_t *list) {
+    for (const char *p = text; (p = strstr(p, "-D")); p += 2) {
+        if (p > text && !strchr(" \t\n=\"'(`,", p[-1])) continue;
+
+        const char *name = p + 2;
+        if (!isalpha((unsigned char)*name) && *name != '_') continue;
+        size_t len = 0;
+        while (is_word_char(name[len])) len++;
+        if (name[len] == '=') {
+            len++;
+            while (name[len] && !strchr(" \t\r\n\"')`,;\\", name[len])) len++;
+        }
+
+        if (name[len] && !strchr(" \t\r\n\"')`,;\\", name[len])) continue;
+        add_found(list, name, len, DEP_TYPE_DEFINE);
+    }
+}
+
+// Add the definitions of CMake's add_compile_definitions(FOO BAR=1) and
+// target_compile_definitions(target PRIVATE FOO), without the target
+static void add_definition_list(dependency_list_t *list, const char *p, const char *end,
+                                int skip_target) {
+    while (p < end) {
+        p += strspn(p, " \t\r\n\"");
+        if (p >= end) break;
+        size_t len = strcspn(p, " \t\r\n\")");
+        if (p + len > end) len = end - p;
+        const char *word = p;
+        p += len;
+
+        if (skip_target) {
+            skip_target = 0;
+            continue;
+        }
+
+        // Generator expressions and the PRIVATE, PUBLIC and INTERFACE keywords
+        if (*word == '$' || (len == 7 && strncmp(word, "PRIVATE", 7) == 0) ||
+            (len == 6 && strncmp(word, "PUBLIC", 6) == 0) ||
+            (len == 9 && strncmp(word, "INTERFACE", 9) == 0))
+            continue;
+
+        if (len > 2 && strncmp(word, "-D", 2) == 0) {
+            word += 2;
+            len -= 2;
+        }
+        if (isalpha((unsigned char)*word) || *word == '_') add_found(list, word, len, DEP_TYPE_DEFINE);
+    }
+}
+
+// Find the next call of a function, returns the position to search from
+// next or NULL. 'args' and 'args_end' get the text between the parentheses.
+static const char* find_call(const char *p, const char *name, int ignore_case, char quote,
+                             const char **args, const char **args_end) {
+    size_t name_len = strlen(name);
+    const char *start = p;
+
+    for (; *p; p++) {
+        if (ignore_case ? strncasecmp(p, name, name_len) != 0 : strncmp(p, name, name_len) != 0)
+            continue;
+
+        // Whole words only, method calls are fine
+        const char *q = p + name_len;
+        if (is_word_char(*q)) continue;
+        if (p > start && is_word_char(p[-1])) continue;
+
+        while (*q == ' ' || *q == '\t') q++;
+        if (*q != '(') continue;
+
+        // Matching parenthesis
+        *args = ++q;
+        int depth = 1;
+        int in_string = 0;
+        for (; *q; q++) {
+            if (quote && *q == quote) {
+                in_string = !in_string;
+            } else if (!in_string && *q == '(') {
+                depth++;
+            } else if (!in_string && *q == ')' && --depth == 0) {
+                break;
+            }
+        }
+
+        *args_end = q;
+        return *q ? q + 1 : q;
+    }
+
+    return NULL;
+}
+
+// Get the nth comma-separated m4 argument without its [quotes]
+static int get_m4_argument(const char *args, const char *end, int n,
+                           const char **start, const char **stop) {
+    int depth = 0;
+    int index = 0;
+    const char *arg = args;
+
+    for (const char *p = args; p <= end; p++) {
+        if (p < end && (*p == '[' || *p == '(')) {
+            depth++;
+        } else if (p < end && (*p == ']' || *p == ')')) {
+            depth--;
+        } else if (p == end || (*p == ',' && depth == 0)) {
+            if (index == n) {
+                while (arg < p && (isspace((unsigned char)*arg) || *arg == '[')) arg++;
+                const char *arg_end = p;
+                while (arg_end > arg && (isspace((unsigned char)arg_end[-1]) || arg_end[-1] == ']'))
+                    arg_end--;
+                *start = arg;
+                *stop = arg_end;
+                return 0;
+            }
+            index++;
+            arg = p + 1;
+        }
+    }
+
+    return -1;
+}
+
+void scan_makefile(const char *data, size_t size, dependency_list_t *list) {
+    char *text = strip_comments(data, size, COMMENT_MAKE);
+    if (!text) return;
+
+    // -l flags starting a word, "--all-static" or "-Wl,-rpath" don't count
+    for (const char *p = text; (p = strstr(p, "-l")); p += 2) {
+        if (p > text && !strchr(" \t\n=\"'(`,", p[-1])) continue;
+
+        const char *name = p + 2;
+        size_t len = 0;
+        while (isalnum((unsigned char)name[len]) || strchr("_-+.", name[len]))
+            len++;
+        while (len > 0 && name[len - 1] == '.') len--;
+
+        if (name[len] && !strchr(" \t\r\n\"')`,;\\", name[len])) continue;
+        add_found(list, name, len, DEP_TYPE_LIBRARY);
+    }
+
+    scan_define_flags(text, list);
+    scan_pkg_config_calls(text, list);
+    free(text);
+}
+
+void scan_cmake(const char *data, size_t size, dependency_list_t *list) {
+    char *text = strip_comments(data, size, COMMENT_CMAKE);
+    if (!text) return;
+
+    static const char *module_calls[] = { "pkg_check_modules", "pkg_search_module" };
+    const char *args, *end;
+    for (size_t i = 0; i < sizeof(module_calls) / sizeof(module_calls[0]); i++) {
+        for (const char *p = text; (p = find_call(p, module_calls[i], 1, '"', &args, &end)); ) {
+            // The first argument is the variable prefix
+            args += strspn(args, " \t\r\n");
+            args += strcspn(args, " \t\r\n");
+            if (args < end) add_module_list(list, args, end, 1);
+        }
+    }
+
+    for (const char *p = text; (p = find_call(p, "find_package", 1, '"', &args, &end)); ) {
+        args += strspn(args, " \t\r\n\"");
+        size_t len = strcspn(args, " \t\r\n\")");
+        if (args + len > end || len == 0 || len >= MAX_NAME_LEN) continue;
+
+        size_t j = 0;
+        size_t count = sizeof(cmake_packages) / sizeof(cmake_packages[0]);
+        while (j < count && (strlen(cmake_packages[j].package) != len ||
+                             strncmp(cmake_packages[j].package, args, len) != 0))
+            j++;
+
+        if (j < count) {
+            if (cmake_packages[j].module)
+                add_found(list, cmake_packages[j].module, strlen(cmake_packages[j].module),
+                          DEP_TYPE_PKGCONFIG);
+            continue;
+        }
+
+        // Unknown package, searched as a library
+        char name[MAX_NAME_LEN];
+        for (size_t k = 0; k < len; k++) {
+            name[k] = tolower((unsigned char)args[k]);
+        }
+        add_found(list, name, len, DEP_TYPE_LIBRARY);
+    }
+
+    // add_definitions() takes -D flags, found with the ones of CMAKE_C_FLAGS
+    for (const char *p = text; (p = find_call(p, "add_compile_definitions", 1, '"', &args, &end)); ) {
+        add_definition_list(list, args, end, 0);
+    }
+    for (const char *p = text; (p = find_call(p, "target_compile_definitions", 1, '"', &args, &end)); ) {
+        add_definition_list(list, args, end, 1);
+    }
+
+    scan_define_flags(text, list);
+    scan_pkg_config_calls(text, list);
+    free(text);
+}
+
+// Add the positional 'string' arguments of a meson call
+static void add_meson_names(dependency_list_t *list, const char *p, const char *end,
+                            dependency_type_t type) {
+    while (p < end) {
+        p += strspn(p, " \t\r\n,");
+        if (p >= end || *p != '\'') break;
+
+        const char *name = ++p;
+        while (p < end && *p != '\'') p++;
+        size_t len = p - name;
+        p++;
+
+        int builtin = 0;
+        for (size_t i = 0; i < sizeof(meson_builtin) / sizeof(meson_builtin[0]); i++) {
+            builtin |= strlen(meson_builtin[i]) == len && strncmp(meson_builtin[i], name, len) == 0;
+        }
+        if (!builtin) add_found(list, name, len, type);
+    }
+}
+
+void scan_meson(const char *data, size_t size, dependency_list_t *list) {
+    char *text = strip_comments(data, size, COMMENT_MESON);
+    if (!text) return;
+
+    const char *args, *end;
+    for (const char *p = text; (p = find_call(p, "dependency", 0, '\'', &args, &end)); ) {
+        add_meson_names(list, args, end, DEP_TYPE_PKGCONFIG);
+    }
+    for (const char *p = text; (p = find_call(p, "find_library", 0, '\'', &args, &end)); ) {
+        add_meson_names(list, args, end, DEP_TYPE_LIBRARY);
+    }
+
+    // '-DFOO' arguments of add_project_arguments() and the like
+    scan_define_flags(text, list);
+    free(text);
+}
+
+void scan_autoconf(const char *data, size_t size, dependency_list_t *list) {
+    char *text = strip_comments(data, size, COMMENT_M4);
+    if (!text) return;
+
+    // Macro, argument holding the names and what they are
+    static const struct {
+        const char *macro;
+        int argument;
+        dependency_type_t type;
+    } macros[] = {
+        { "PKG_CHECK_MODULES", 1, DEP_TYPE_PKGCONFIG },
+        { "PKG_CHECK_EXISTS", 0, DEP_TYPE_PKGCONFIG },
+        { "AC_CHECK_LIB", 0, DEP_TYPE_LIBRARY },
+        { "AC_SEARCH_LIBS", 1, DEP_TYPE_LIBRARY },
+    };
+
+    const char *args, *end, *start, *stop;
+    for (size_t i = 0; i < sizeof(macros) / sizeof(macros[0]); i++) {
+        for (const char *p = text; (p = find_call(p, macros[i].macro, 0, 0, &args, &end)); ) {
+            if (get_m4_argument(args, end, macros[i].argument, &start, &stop) != 0) continue;
+
+            if (macros[i].type == DEP_TYPE_PKGCONFIG) {
+                add_module_list(list, start, stop, 0);
+                continue;
+            }
+
+            while (start < stop) {
+                start += strspn(start, WORD_SEPARATORS);
+                size_t len = strcspn(start, WORD_SEPARATORS);
+                if (start + len > stop) len = stop - start;
+                if (len > 0 && *start != '$') add_found(list, start, len, DEP_TYPE_LIBRARY);
+                start += len;
+            }
+        }
+    }
+
+    scan_pkg_config_calls(text, list);
+    free(text);
+}
@@ -0,0 +1,26 @@
+#ifndef BUILDFILES_H
+#define BUILDFILES_H 1
+
+#include <stddef.h>
+
+#include "parser.h"
+
+// Dependencies declared by build files: libraries linked with -l and
+// pkg-config modules, plus the macros defined with -D for the C files.
+// Each scanner adds what it finds to 'list'.
+
+// Makefiles: -l and -D flags and pkg-config calls
+void scan_makefile(const char *data, size_t size, dependency_list_t *list);
+
+// CMakeLists.txt and *.cmake: pkg_check_modules(), pkg_search_module(),
+// find_package(), compile definitions, -D flags and pkg-config calls
+void scan_cmake(const char *data, size_t size, dependency_list_t *list);
+
+// meson.build: dependency(), find_library() and -D flags
+void scan_meson(const char *data, size_t size, dependency_list_t *list);
+
+// configure.ac: PKG_CHECK_MODULES(), PKG_CHECK_EXISTS(), AC_CHECK_LIB(),
+// AC_SEARCH_LIBS() and pkg-config calls
+void scan_autoconf(const char *data, size_t size, dependency_list_t *list);
+
+#endif // BUILDFILES_H
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "ddn_config.h"
+#include "cache.h"
+#include "paths.h"
+#include "mapping.h"
+
+// Bump when the way dependencies get resolved changes,
+// so that old entries don't get reused
+#define CACHE_VERSION 2
+
+// Fingerprints end with the hash of the header mapping rules, entries
+// resolved under other rules get dropped like those of other repositories
+#define RULES_SUFFIX_LEN 17
+
+#define CACHE_INITIAL_CAPACITY 64
+
+// Get the cache directory, or NULL if neither XDG_CACHE_HOME nor HOME are set
+static char* get_cache_dir(void) {
+    return get_xdg_dir("XDG_CACHE_HOME", ".cache");
+}
+
+// Fingerprint of the repositories and of the mapping rules in use
+static char* full_fingerprint(const char *fingerprint) {
+    char *full;
+    if (asprintf(&full, "%s-%016llx", fingerprint, (unsigned long long)mapping_hash()) < 0)
+        return NULL;
+    return full;
+}
+
+// Whether a stored fingerprint was made with the mapping rules in use
+static int same_rules(const char *fingerprint) {
+    char suffix[RULES_SUFFIX_LEN + 1];
+    snprintf(suffix, sizeof(suffix), "-%016llx", (unsigned long long)mapping_hash());
+    size_t len = strlen(fingerprint);
+    return len > RULES_SUFFIX_LEN && strcmp(fingerprint + len - RULES_SUFFIX_LEN, suffix) == 0;
+}
+
+// Number of entries, none once an allocation failure left no keys
+static int cache_count(const resolution_cache_t *cache) {
+    return cache->keys ? cache->keys->count : 0;
+}
+
+// Set the packages of a key, adding the key if needed
+static void cache_set(resolution_cache_t *cache, const char *name,
+                      dependency_type_t type, const char *packages) {
+    int index = find_dependency(cache->keys, name, type);
+    if (index < 0) {
+        if (!cache->keys) return;
+
+        // Room for the value first, so that every key has one
+        if (cache->keys->count >= cache->capacity) {
+            int capacity = cache->capacity ? cache->capacity * 2 : CACHE_INITIAL_CAPACITY;
+            char **tmp = realloc(cache->packages, capacity * sizeof(char*));
+            if (!tmp) return;
+            cache->packages = tmp;
+            cache->capacity = capacity;
+        }
+
+        add_dependency(cache->keys, name, type);
+        index = find_dependency(cache->keys, name, type);
+        if (index < 0) return;
+        cache->packages[index] = NULL;
+    }
+
+    free(cache->packages[index]);
+    cache->packages[index] = strdup(packages);
+}
+
+// Drop all the entries. The keys are left NULL if a new list can't be
+// made, the cache then stays empty.
+static void cache_clear(resolution_cache_t *cache) {
+    for (int i = 0; i < cache_count(cache); i++) {
+        free(cache->packages[i]);
+    }
+    free(cache->packages);
+    cache->packages = NULL;
+    cache->capacity = 0;
+    free_dependency_list(cache->keys);
+    cache->keys = create_dependency_list();
+}
+
+static void cache_load(resolution_cache_t *cache) {
+    FILE *f = fopen(cache->path, "r");
+    if (!f) return;
+
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+
+    // Header, skip the whole file if it was written by another version
+    int version = 0;
+    if (getline(&line, &size, f) <= 0 || sscanf(line, "ddn-cache %d", &version) != 1 ||
+        version != CACHE_VERSION) {
+        if (config.debug)
+            printf("ddn:cache_load(): ignoring '%s' (version %d)\n", cache->path, version);
+        free(line);
+        fclose(f);
+        return;
+    }
+
+    while ((len = getline(&line, &size, f)) > 0) {
+        if (line[len - 1] == '\n') line[--len] = '\0';
+
+        if (strncmp(line, "fingerprint ", 12) == 0) {
+            char fingerprint[128];
+            long long checked;
+            // Entries of other rules are never fresh, the next fingerprint drops them
+            if (sscanf(line + 12, "%127s %lld", fingerprint, &checked) == 2 &&
+                same_rules(fingerprint)) {
+                free(cache->fingerprint);
+                cache->fingerprint = strdup(fingerprint);
+                cache->checked = (time_t)checked;
+            }
+            continue;
+        }
+
+        // <type>\t<name>\t<packages>
+        dependency_type_t type;
+        if (len < 3 || line[1] != '\t' || dependency_type_from_char(line[0], &type) != 0) continue;
+
+        char *name = line + 2;
+        char *packages = strchr(name, '\t');
+        if (!packages) continue;
+        *packages++ = '\0';
+
+        cache_set(cache, name, type, packages);
+    }
+
+    free(line);
+    fclose(f);
+
+    if (config.debug)
+        printf("ddn:cache_load(): loaded %d entries from '%s'\n", cache_count(cache), cache->path);
+}
+
+resolution_cache_t* cache_open(const char *distro_name) {
+    char *dir = get_cache_dir();
+    if (!dir) return NULL;
+
+    resolution_cache_t *cache = calloc(1, sizeof(resolution_cache_t));
+    if (!cache) {
+        free(dir);
+        return NULL;
+    }
+
+    cache->keys = create_dependency_list();
+    // Exact resolutions are kept apart from name searches
+    if (!cache->keys || asprintf(&cache->path, "%s/%s%s.cache", dir, distro_name,
+                                 config.exact ? ".exact" : "") < 0) {
+        free_dependency_list(cache->keys);
+        free(cache);
+        free(dir);
+        return NULL;
+    }
+    free(dir);
+
+    // With --refresh everything gets queried again and overwritten
+    if (!config.refresh_cache)
+        cache_load(cache);
+
+    return cache;
+}
+
+int cache_is_fresh(resolution_cache_t *cache) {
+    if (!cache || !cache->fingerprint) return 0;
+    if (cache->verified) return 1;
+
+    time_t now = time(NULL);
+    return now >= cache->checked && now - cache->checked < config.cache_ttl;
+}
+
+void cache_set_fingerprint(resolution_cache_t *cache, const char *fingerprint) {
+    if (!cache || !fingerprint) return;
+
+    char *full = full_fingerprint(fingerprint);
+    if (!full) return;
+
+    if (!cache->fingerprint || strcmp(cache->fingerprint, full) != 0) {
+        if (config.debug)
+            printf("ddn:cache_set_fingerprint(): repositories or rules changed, dropping '%s'\n",
+                   cache->path);
+        cache_clear(cache);
+        free(cache->fingerprint);
+        cache->fingerprint = full;
+    } else {
+        free(full);
+    }
+
+    cache->checked = time(NULL);
+    cache->verified = 1;
+    cache->modified = 1;
+}
+
+const char* cache_lookup(resolution_cache_t *cache, const dependency_t *dep) {
+    if (!cache || !dep || !cache->fingerprint) return NULL;
+
+    int index = find_dependency(cache->keys, dep->name, dep->type);
+    return index >= 0 ? cache->packages[index] : NULL;
+}
+
+void cache_store(resolution_cache_t *cache, const dependency_t *dep, package_list_t *packages) {
+    if (!cache || !dep || !packages || !cache->fingerprint) return;
+
+    // "<name>" or "<name>=<confidence>" with --exact
+    char *value = format_package_string(packages);
+    if (!value) return;
+
+    cache_set(cache, dep->name, dep->type, value);
+    cache->modified = 1;
+    free(value);
+}
+
+int cache_save(resolution_cache_t *cache) {
+    if (!cache || !cache->modified || !cache->fingerprint) return 0;
+
+    char *dir = get_cache_dir();
+    if (!dir || make_dirs(dir) != 0) {
+        if (config.debug)
+            printf("ddn:cache_save(): cannot create cache directory: %s\n", strerror(errno));
+        free(dir);
+        return -1;
+    }
+    free(dir);
+
+    // Write a temporary file first so that other runs never see a partial cache
+    char *tmp_path = NULL;
+    if (asprintf(&tmp_path, "%s.%d.tmp", cache->path, (int)getpid()) < 0) return -1;
+
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        free(tmp_path);
+        return -1;
+    }
+
+    fprintf(f, "ddn-cache %d\n", CACHE_VERSION);
+    fprintf(f, "fingerprint %s %lld\n", cache->fingerprint, (long long)cache->checked);
+    for (int i = 0; i < cache_count(cache); i++) {
+        fprintf(f, "%c\t%s\t%s\n", dependency_type_char(cache->keys->items[i].type),
+                cache->keys->items[i].name, cache->packages[i] ? cache->packages[i] : "");
+    }
+
+    if (fclose(f) != 0 || rename(tmp_path, cache->path) != 0) {
+        unlink(tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+    free(tmp_path);
+
+    cache->modified = 0;
+    return 0;
+}
+
+void cache_close(resolution_cache_t *cache) {
+    if (!cache) return;
+
+    for (int i = 0; i < cache_count(cache); i++) {
+        free(cache->packages[i]);
+    }
+    free(cache->packages);
+    free_dependency_list(cache->keys);
+    free(cache->fingerprint);
+    free(cache->path);
+    free(cache);
+}
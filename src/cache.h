@@ -0,0 +1,46 @@
+#ifndef CACHE_H
+#define CACHE_H 1
+
+#include <time.h>
+
+#include "parser.h"
+#include "vm_query.h"
+
+// Resolved packages of one distro, stored under $XDG_CACHE_HOME/distro-dep-name
+typedef struct {
+    char *path;
+    char *fingerprint;          // Repository metadata fingerprint the entries belong to
+    time_t checked;             // When the fingerprint was last compared with the VM
+    int verified;               // Fingerprint compared during this run
+    dependency_list_t *keys;
+    char **packages;            // Space-separated package names, one per key,
+                                // each followed by "=<confidence>" with --exact
+    int capacity;               // Values 'packages' has room for
+    int modified;
+} resolution_cache_t;
+
+// Load the cache of a distro, an empty cache is returned if there's no file yet.
+// --exact resolutions have a cache of their own.
+resolution_cache_t* cache_open(const char *distro_name);
+
+// Whether the entries can be trusted: the fingerprint was either compared
+// during this run or recently enough not to ask the VM again
+int cache_is_fresh(resolution_cache_t *cache);
+
+// Compare the cache with the VM's current fingerprint, dropping all entries if
+// the repositories changed
+void cache_set_fingerprint(resolution_cache_t *cache, const char *fingerprint);
+
+// Get the cached packages of a dependency, or NULL if it's not cached
+const char* cache_lookup(resolution_cache_t *cache, const dependency_t *dep);
+
+// Store the resolved packages of a dependency
+void cache_store(resolution_cache_t *cache, const dependency_t *dep, package_list_t *packages);
+
+// Write the cache file if anything changed, returns 0 on success
+int cache_save(resolution_cache_t *cache);
+
+// Free the cache
+void cache_close(resolution_cache_t *cache);
+
+#endif // CACHE_H
@@ -1,12 +1,44 @@
 #ifndef DDN_CONFIG_H
 #define DDN_CONFIG_H 1
 
+// What gets written to stdout, see --format
+typedef enum {
+    FORMAT_MARKDOWN,
+    FORMAT_JSON,
+    FORMAT_NDJSON,
+    FORMAT_SHELL
+} output_format_t;
+
 typedef struct {
     int debug;
     char **distros;
     int distro_count;
     char *source_path;
     int all_distros;
+    int batch;
+    int exact;
+    int jobs;
+    int no_cache;
+    int refresh_cache;
+    long cache_ttl;
+    int offline;
+    char *index_dir;
+    int incremental;
+    char *manifest_path;
+    int stats;
+    char *trace_path;
+    char *rules_path;
+    char *probe_compiler;
+    output_format_t format;
+    int with_optional;
+    int serve;
+    char *socket_path;
+    int no_server;
+    long timeout;
+    long distro_timeout;
+    int retries;
+    long hedge_delay;
+    int warm_up;
 } config_t;
 
 // From main.c
@@ -4,13 +4,20 @@
 #include "distro.h"
 
 static const distro_info_t distros[] = {
-    {"arch", DISTRO_ARCH, "pacman", "pacman -S "},
-    {"alpine", DISTRO_ALPINE, "apk", "apk add"},
-    {"debian", DISTRO_DEBIAN, "apt", "apt install "},
-    {"fedora", DISTRO_FEDORA, "dnf", "dnf install"},
-    {"gentoo", DISTRO_GENTOO, "emerge", "emerge"},
-    {"opensuse", DISTRO_OPENSUSE, "zypper", "zypper install"},
-    {"ubuntu", DISTRO_UBUNTU, "apt", "apt install"}
+    {"arch", DISTRO_ARCH, "pacman", "pacman -S ",
+        "/var/lib/pacman/sync/*.db"},
+    {"alpine", DISTRO_ALPINE, "apk", "apk add",
+        "/etc/apk/repositories /var/cache/apk/APKINDEX.* /lib/apk/db/installed"},
+    {"debian", DISTRO_DEBIAN, "apt", "apt install ",
+        "/var/lib/apt/lists/*Packages*"},
+    {"fedora", DISTRO_FEDORA, "dnf", "dnf install",
+        "/var/cache/dnf/*/repodata/repomd.xml /var/cache/libdnf5/*/repodata/repomd.xml"},
+    {"gentoo", DISTRO_GENTOO, "emerge", "emerge",
+        "/var/db/repos/*/metadata/timestamp.chk /usr/portage/metadata/timestamp.chk"},
+    {"opensuse", DISTRO_OPENSUSE, "zypper", "zypper install",
+        "/var/cache/zypp/raw/*/repodata/repomd.xml"},
+    {"ubuntu", DISTRO_UBUNTU, "apt", "apt install",
+        "/var/lib/apt/lists/*Packages*"}
 };
 
 int get_distro_count(void) {
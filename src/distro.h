@@ -16,6 +16,7 @@ typedef struct {
     distro_type_t type;
     const char *package_manager;
     const char *install_command;
+    const char *metadata_paths;  // Repository metadata files, used to detect repo changes
 } distro_info_t;
 
 // Get number of supported distros
@@ -0,0 +1,31 @@
+#ifndef HASH_H
+#define HASH_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HASH_INIT 2166136261u
+
+// FNV-1a, continues from 'hash' so that several fields can be hashed together
+static inline uint32_t hash_bytes(uint32_t hash, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+#define HASH64_INIT 14695981039346656037ull
+
+// 64-bit FNV-1a, for file contents
+static inline uint64_t hash_bytes64(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+#endif // HASH_H
@@ -9,29 +9,144 @@
 #include "vm_query.h"
 #include "distro.h"
 #include "output.h"
+#include "pool.h"
+#include "stats.h"
+#include "mapping.h"
+#include "sysheaders.h"
+#include "preproc.h"
+#include "server.h"
 
 #define VERSION "0.0.5"
+#define DEFAULT_JOBS 4
+#define DEFAULT_CACHE_TTL (24 * 60 * 60)
+#define DEFAULT_TIMEOUT 120
+#define DEFAULT_DISTRO_TIMEOUT 900
+#define DEFAULT_RETRIES 2
+#define DEFAULT_HEDGE_DELAY 2000
+
+// Options without a short form
+enum {
+    OPT_NO_CACHE = 256,
+    OPT_REFRESH,
+    OPT_CACHE_TTL,
+    OPT_INDEX_DIR,
+    OPT_MANIFEST,
+    OPT_STATS,
+    OPT_TRACE,
+    OPT_RULES,
+    OPT_PROBE_CC,
+    OPT_FORMAT,
+    OPT_DEFINE,
+    OPT_UNDEFINE,
+    OPT_WITH_OPTIONAL,
+    OPT_SERVE,
+    OPT_SOCKET,
+    OPT_NO_SERVER,
+    OPT_TIMEOUT,
+    OPT_DISTRO_TIMEOUT,
+    OPT_RETRIES,
+    OPT_HEDGE_AFTER,
+    OPT_WARM_UP
+};
 
 static const struct option long_options[] = {
     {"debug", no_argument, 0, 'D'},
     {"distro", required_argument, 0, 'd'},
+    {"jobs", required_argument, 0, 'j'},
     {"all", no_argument, 0, 'a'},
+    {"batch", no_argument, 0, 'b'},
+    {"exact", no_argument, 0, 'x'},
     {"list-distros", no_argument, 0, 'l'},
+    {"incremental", no_argument, 0, 'i'},
+    {"manifest", required_argument, 0, OPT_MANIFEST},
+    {"offline", no_argument, 0, 'o'},
+    {"index-dir", required_argument, 0, OPT_INDEX_DIR},
+    {"rules", required_argument, 0, OPT_RULES},
+    {"probe-cc", optional_argument, 0, OPT_PROBE_CC},
+    {"define", required_argument, 0, OPT_DEFINE},
+    {"undefine", required_argument, 0, OPT_UNDEFINE},
+    {"with-optional", no_argument, 0, OPT_WITH_OPTIONAL},
+    {"format", required_argument, 0, OPT_FORMAT},
+    {"serve", no_argument, 0, OPT_SERVE},
+    {"socket", required_argument, 0, OPT_SOCKET},
+    {"no-server", no_argument, 0, OPT_NO_SERVER},
+    {"stats", no_argument, 0, OPT_STATS},
+    {"trace", required_argument, 0, OPT_TRACE},
+    {"no-cache", no_argument, 0, OPT_NO_CACHE},
+    {"refresh", no_argument, 0, OPT_REFRESH},
+    {"cache-ttl", required_argument, 0, OPT_CACHE_TTL},
+    {"timeout", required_argument, 0, OPT_TIMEOUT},
+    {"distro-timeout", required_argument, 0, OPT_DISTRO_TIMEOUT},
+    {"retries", required_argument, 0, OPT_RETRIES},
+    {"hedge-after", required_argument, 0, OPT_HEDGE_AFTER},
+    {"warm-up", no_argument, 0, OPT_WARM_UP},
     {"help", no_argument, 0, 'h'},
     {"version", no_argument, 0, 'V'},
     {0, 0, 0, 0}
 };
-static const char *short_options = "Dd:alhV";
+static const char *short_options = "Dd:j:abxiolhV";
 
 config_t config;
 
+typedef struct {
+    distro_packages_t *results;
+    dependency_list_t *deps;
+} distro_jobs_t;
+
 void print_usage(const char *prog_name) {
     printf("Usage: %s [OPTIONS] <source_path>\n", prog_name);
-    printf("\nAnalyze source code and generate distro-specific dependency install commands.\n\n");
+    printf("       %s [OPTIONS] index build\n", prog_name);
+    printf("       %s [OPTIONS] --serve\n", prog_name);
+    printf("\nAnalyze source code and generate distro-specific dependency install commands.\n");
+    printf("'index build' dumps the selected distros' file lists from their VMs into local\n");
+    printf("indexes, used afterwards to resolve dependencies without a VM.\n\n");
     printf("Options:\n");
     printf("  -D, --debug            Show detailed informations for debugging purposes\n");
     printf("  -d, --distro <name>    Specify a distro (can be used multiple times)\n");
+    printf("  -j, --jobs <n>         Run up to n queries at once for each distro and parse\n");
+    printf("                         on up to n threads (default %d)\n", DEFAULT_JOBS);
     printf("  -a, --all              Query all supported distros (default)\n");
+    printf("  -b, --batch            Send all the queries for a distro in one remote script\n");
+    printf("  -x, --exact            Ask which package owns each header or library file and\n");
+    printf("                         keep one package per dependency, rated by confidence\n");
+    printf("  -i, --incremental      Only parse the files that changed since the last run,\n");
+    printf("                         recorded in <source_path>/.ddn-manifest\n");
+    printf("      --manifest <file>  Use another manifest file (implies -i)\n");
+    printf("  -o, --offline          Only resolve from the local indexes, never contact the VMs\n");
+    printf("      --index-dir <dir>  Directory of the local indexes\n");
+    printf("                         (default $XDG_DATA_HOME/distro-dep-name)\n");
+    printf("      --no-cache         Don't read nor write the resolution cache\n");
+    printf("      --refresh          Query everything again and overwrite the cache\n");
+    printf("      --cache-ttl <secs> Trust cached results without contacting the VM for\n");
+    printf("                         this long (default %d)\n", DEFAULT_CACHE_TTL);
+    printf("      --timeout <secs>   Kill remote queries running longer than this, 0 for\n");
+    printf("                         never (default %d)\n", DEFAULT_TIMEOUT);
+    printf("      --distro-timeout <secs>\n");
+    printf("                         Give up on a distro's remaining queries after this\n");
+    printf("                         long, 0 for never (default %d)\n", DEFAULT_DISTRO_TIMEOUT);
+    printf("      --retries <n>      Retry queries failing on a timeout or a connection\n");
+    printf("                         error up to n times (default %d)\n", DEFAULT_RETRIES);
+    printf("      --hedge-after <ms> Send a slow query to the next host of DISTRO_VM_<name>\n");
+    printf("                         too, 0 to never do it (default %d)\n", DEFAULT_HEDGE_DELAY);
+    printf("      --warm-up          Dump the package lists once before the name searches\n");
+    printf("                         of Debian, Ubuntu, Fedora and openSUSE, which then\n");
+    printf("                         don't load the repository metadata each time\n");
+    printf("      --rules <file>     Add header to library rules, see README.md\n");
+    printf("      --probe-cc[=<cc>]  Also skip the headers of the compiler's own include\n");
+    printf("                         directories (default $CC or cc)\n");
+    printf("      --define <m>[=<v>] Consider a macro defined in conditional blocks\n");
+    printf("      --undefine <m>     Consider a macro undefined in conditional blocks\n");
+    printf("      --with-optional    Also resolve the headers of conditional blocks that\n");
+    printf("                         depend on unknown macros\n");
+    printf("      --format <format>  Output format: markdown (default), json, ndjson (one\n");
+    printf("                         record per distro as soon as it's resolved) or shell\n");
+    printf("      --serve            Resolve for the other runs on this host, keeping the VM\n");
+    printf("                         connections and the results of every run\n");
+    printf("      --socket <path>    Socket of the server (default\n");
+    printf("                         $XDG_RUNTIME_DIR/distro-dep-name.sock)\n");
+    printf("      --no-server        Resolve locally even if a server is running\n");
+    printf("      --stats            Print where the time went and what was done\n");
+    printf("      --trace <file>     Write a Chrome trace event file of the run\n");
     printf("  -l, --list-distros     List supported distros and exit\n");
     printf("  -h, --help             Show this help message\n");
     printf("  -V, --version          Show version information\n");
@@ -41,12 +156,70 @@ void print_usage(const char *prog_name) {
     }
 }
 
+// Query one distro, each worker fills its own result slot
+static void query_distro_worker(int index, void *arg) {
+    distro_jobs_t *jobs = arg;
+    distro_packages_t *result = &jobs->results[index];
+    result->packages = query_distro_packages(result->distro_name, jobs->deps, &result->details);
+    emit_distro_result(result, jobs->deps);
+}
+
+// Build one distro's index
+static void build_index_worker(int index, void *arg) {
+    const char **distro_names = arg;
+    if (build_distro_index(distro_names[index]) != 0)
+        distro_names[index] = NULL;
+}
+
+// Free what mapping_init() and probe_compiler_headers() loaded, and the
+// macros the parser defined
+static void free_header_rules(void) {
+    mapping_free();
+    preproc_free();
+    free_compiler_headers();
+}
+
+// Run 'index build' for the selected distros, returns the exit status
+static int run_index_command(int argc, char *argv[]) {
+    if (optind + 1 >= argc || strcmp(argv[optind + 1], "build") != 0) {
+        fprintf(stderr, "Error: unknown index command, expected 'index build'\n\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    int count = config.all_distros ? get_distro_count() : config.distro_count;
+    const char **distro_names = malloc(count * sizeof(char*));
+    if (!distro_names) {
+        fprintf(stderr, "ddn:run_index_command(): Memory allocation failed\n");
+        return ENOMEM;
+    }
+    for (int i = 0; i < count; i++) {
+        distro_names[i] = config.all_distros ? get_distro_name(i) : config.distros[i];
+    }
+
+    pool_run(count, count, build_index_worker, distro_names);
+
+    int ret = 0;
+    for (int i = 0; i < count; i++) {
+        if (!distro_names[i]) ret = 1;
+    }
+    free(distro_names);
+
+    return ret;
+}
+
 void print_version(void) {
     printf("distro-dep-name version %s\nhttps://github.com/esselfe/distro-dep-name/\n", VERSION);
 }
 
 int main(int argc, char *argv[]) {
     config.all_distros = 1; // Default to all distros
+    config.jobs = DEFAULT_JOBS;
+    config.cache_ttl = DEFAULT_CACHE_TTL;
+    config.timeout = DEFAULT_TIMEOUT;
+    config.distro_timeout = DEFAULT_DISTRO_TIMEOUT;
+    config.retries = DEFAULT_RETRIES;
+    config.hedge_delay = DEFAULT_HEDGE_DELAY;
 
     int distro_capacity = 10;
     config.distros = malloc(distro_capacity * sizeof(char*));
@@ -55,6 +228,9 @@ int main(int argc, char *argv[]) {
         return ENOMEM;
     }
 
+    // Conditional blocks are evaluated for a Linux target
+    preproc_init();
+
     int opt;
     while ((opt = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
         switch (opt) {
@@ -73,9 +249,124 @@ int main(int argc, char *argv[]) {
                 config.distros[config.distro_count++] = strdup(optarg);
                 config.all_distros = 0;
                 break;
+            case 'j':
+                config.jobs = atoi(optarg);
+                if (config.jobs < 1) {
+                    fprintf(stderr, "Error: invalid number of jobs '%s'\n", optarg);
+                    free(config.distros);
+                    return 1;
+                }
+                break;
             case 'a':
                 config.all_distros = 1;
                 break;
+            case 'b':
+                config.batch = 1;
+                break;
+            case 'x':
+                config.exact = 1;
+                break;
+            case 'i':
+                config.incremental = 1;
+                break;
+            case OPT_MANIFEST:
+                config.manifest_path = optarg;
+                config.incremental = 1;
+                break;
+            case 'o':
+                config.offline = 1;
+                break;
+            case OPT_INDEX_DIR:
+                config.index_dir = optarg;
+                break;
+            case OPT_RULES:
+                config.rules_path = optarg;
+                break;
+            case OPT_PROBE_CC:
+                config.probe_compiler = optarg ? optarg : getenv("CC");
+                if (!config.probe_compiler || !*config.probe_compiler)
+                    config.probe_compiler = "cc";
+                break;
+            case OPT_DEFINE:
+                preproc_define(optarg, 1);
+                break;
+            case OPT_UNDEFINE:
+                preproc_undefine(optarg, 1);
+                break;
+            case OPT_WITH_OPTIONAL:
+                config.with_optional = 1;
+                break;
+            case OPT_FORMAT:
+                if (parse_output_format(optarg, &config.format) != 0) {
+                    fprintf(stderr, "Error: unknown output format '%s'\n", optarg);
+                    free(config.distros);
+                    return 1;
+                }
+                break;
+            case OPT_SERVE:
+                config.serve = 1;
+                break;
+            case OPT_SOCKET:
+                config.socket_path = optarg;
+                break;
+            case OPT_NO_SERVER:
+                config.no_server = 1;
+                break;
+            case OPT_STATS:
+                config.stats = 1;
+                break;
+            case OPT_TRACE:
+                config.trace_path = optarg;
+                break;
+            case OPT_NO_CACHE:
+                config.no_cache = 1;
+                break;
+            case OPT_REFRESH:
+                config.refresh_cache = 1;
+                break;
+            case OPT_CACHE_TTL:
+                config.cache_ttl = atol(optarg);
+                if (config.cache_ttl < 0) {
+                    fprintf(stderr, "Error: invalid cache TTL '%s'\n", optarg);
+                    free(config.distros);
+                    return 1;
+                }
+                break;
+            case OPT_TIMEOUT:
+                config.timeout = atol(optarg);
+                if (config.timeout < 0) {
+                    fprintf(stderr, "Error: invalid timeout '%s'\n", optarg);
+                    free(config.distros);
+                    return 1;
+                }
+                break;
+            case OPT_DISTRO_TIMEOUT:
+                config.distro_timeout = atol(optarg);
+                if (config.distro_timeout < 0) {
+                    fprintf(stderr, "Error: invalid distro timeout '%s'\n", optarg);
+                    free(config.distros);
+                    return 1;
+                }
+                break;
+            case OPT_RETRIES:
+                config.retries = atoi(optarg);
+                if (config.retries < 0) {
+                    fprintf(stderr, "Error: invalid number of retries '%s'\n", optarg);
+                    free(config.distros);
+                    return 1;
+                }
+                break;
+            case OPT_HEDGE_AFTER:
+                config.hedge_delay = atol(optarg);
+                if (config.hedge_delay < 0) {
+                    fprintf(stderr, "Error: invalid hedge delay '%s'\n", optarg);
+                    free(config.distros);
+                    return 1;
+                }
+                break;
+            case OPT_WARM_UP:
+                config.warm_up = 1;
+                break;
             case 'l':
                 printf("Supported distros:\n");
                 for (int i = 0; i < get_distro_count(); i++) {
@@ -98,10 +389,46 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (stats_init(config.stats, config.trace_path) != 0) {
+        free(config.distros);
+        return 1;
+    }
+
+    // Servers and index builds resolve headers with the same rules as a run
+    if (mapping_init(config.rules_path) != 0) {
+        free(config.distros);
+        return 1;
+    }
+    if (config.probe_compiler)
+        probe_compiler_headers(config.probe_compiler);
+
+    if (config.serve) {
+        int ret = run_server();
+        stats_finish();
+        free_header_rules();
+        for (int i = 0; i < config.distro_count; i++) {
+            free(config.distros[i]);
+        }
+        free(config.distros);
+        return ret;
+    }
+
+    if (optind < argc && strcmp(argv[optind], "index") == 0) {
+        int ret = run_index_command(argc, argv);
+        stats_finish();
+        free_header_rules();
+        for (int i = 0; i < config.distro_count; i++) {
+            free(config.distros[i]);
+        }
+        free(config.distros);
+        return ret;
+    }
+
     // Get source path
     if (optind >= argc) {
         fprintf(stderr, "Error: source path required\n\n");
         print_usage(argv[0]);
+        free_header_rules();
         free(config.distros);
         return 1;
     }
@@ -114,11 +441,59 @@ int main(int argc, char *argv[]) {
     dependency_list_t *deps = parse_dependencies(config.source_path);
     if (!deps) {
         fprintf(stderr, "Failed to parse dependencies\n");
+        free_header_rules();
+        free(config.distros);
+        return 1;
+    }
+
+    // Headers of the C library and the compiler don't need packages
+    dependency_list_t *found = deps;
+    deps = filter_system_headers(found);
+    if (!deps) {
+        fprintf(stderr, "Failed to parse dependencies\n");
+        free_dependency_list(found);
+        free_header_rules();
+        free(config.distros);
+        return 1;
+    }
+
+    int system_headers = found->count - deps->count;
+    free_dependency_list(found);
+
+    // Only what gets compiled on the target goes to the VMs
+    found = deps;
+    deps = select_dependencies(found, config.with_optional ? DEP_OPTIONAL : DEP_REQUIRED);
+    if (!deps) {
+        fprintf(stderr, "Failed to parse dependencies\n");
+        free_dependency_list(found);
+        free_header_rules();
         free(config.distros);
         return 1;
     }
 
-    printf("Found %d dependencies\n\n", deps->count);
+    int optional = 0, excluded = 0;
+    for (int i = 0; i < found->count; i++) {
+        optional += found->items[i].status == DEP_OPTIONAL;
+        excluded += found->items[i].status == DEP_EXCLUDED;
+    }
+    free_dependency_list(found);
+
+    FILE *progress = progress_stream();
+    fprintf(progress, "Found %d dependencies", deps->count);
+    const char *separator = " (";
+    if (optional > 0 && !config.with_optional) {
+        fprintf(progress, "%s%d optional skipped, see --with-optional", separator, optional);
+        separator = ", ";
+    }
+    if (excluded > 0) {
+        fprintf(progress, "%s%d excluded", separator, excluded);
+        separator = ", ";
+    }
+    if (system_headers > 0) {
+        fprintf(progress, "%s%d system headers skipped", separator, system_headers);
+        separator = ", ";
+    }
+    fprintf(progress, "%s\n\n", separator[0] == ',' ? ")" : "");
 
     // Query VMs for each distro
     distro_packages_t *results = NULL;
@@ -126,27 +501,32 @@ int main(int argc, char *argv[]) {
 
     if (config.all_distros) {
         result_count = get_distro_count();
-        results = malloc(result_count * sizeof(distro_packages_t));
+        results = calloc(result_count, sizeof(distro_packages_t));
         for (int i = 0; i < result_count; i++) {
             results[i].distro_name = get_distro_name(i);
-            results[i].packages = query_distro_packages(get_distro_name(i), deps);
         }
     } else {
         result_count = config.distro_count;
-        results = malloc(result_count * sizeof(distro_packages_t));
+        results = calloc(result_count, sizeof(distro_packages_t));
         for (int i = 0; i < result_count; i++) {
             results[i].distro_name = config.distros[i];
-            results[i].packages = query_distro_packages(config.distros[i], deps);
         }
     }
 
+    // All distros are queried at once, results keep the order above
+    distro_jobs_t jobs = { .results = results, .deps = deps };
+    pool_run(result_count, result_count, query_distro_worker, &jobs);
+
     // Generate output
-    generate_install_commands(results, result_count);
+    generate_install_commands(results, result_count, deps);
+    stats_finish();
 
     // Cleanup
     free_dependency_list(deps);
+    free_header_rules();
     for (int i = 0; i < result_count; i++) {
         free_package_list(results[i].packages);
+        free_resolution_details(&results[i].details);
     }
     free(results);
 
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ddn_config.h"
+#include "mapping.h"
+#include "hash.h"
+
+typedef enum {
+    RULE_EXACT,
+    RULE_PREFIX,
+    RULE_SUFFIX
+} rule_kind_t;
+
+typedef struct {
+    const char *pattern;
+    const char *library;        // NULL for system headers
+    rule_kind_t kind;
+} rule_t;
+
+// Built-in rules from mapping.def
+static const rule_t builtin_rules[] = {
+#define MAPPING_RULE(kind, pattern, library) { pattern, library, RULE_##kind },
+#include "mapping.def"
+#undef MAPPING_RULE
+};
+
+// Trie node, children are a linked list of siblings
+typedef struct {
+    int child;
+    int sibling;
+    int exact;                  // Rule ending here, -1 if none
+    int prefix;
+    unsigned char c;
+} trie_node_t;
+
+// Node 0 of each trie is its root
+typedef struct {
+    trie_node_t *nodes;
+    int count;
+    int capacity;
+} trie_t;
+
+static trie_t forward;          // Exact and prefix rules
+static trie_t backward;         // Suffix rules, reversed
+static const char **libraries;  // Library of each rule, NULL for system headers
+static char **owned;            // Strings read from the rules file
+static int rule_count;
+static int owned_count;
+static uint64_t rules_hash = HASH64_INIT;
+
+static int add_node(trie_t *trie, unsigned char c) {
+    if (trie->count >= trie->capacity) {
+        int capacity = trie->capacity ? trie->capacity * 2 : 256;
+        trie_node_t *nodes = realloc(trie->nodes, capacity * sizeof(trie_node_t));
+        if (!nodes) return -1;
+        trie->nodes = nodes;
+        trie->capacity = capacity;
+    }
+
+    trie_node_t *node = &trie->nodes[trie->count];
+    node->child = node->sibling = node->exact = node->prefix = -1;
+    node->c = c;
+    return trie->count++;
+}
+
+static int find_child(const trie_t *trie, int node, unsigned char c) {
+    for (int child = trie->nodes[node].child; child >= 0; child = trie->nodes[child].sibling) {
+        if (trie->nodes[child].c == c) return child;
+    }
+    return -1;
+}
+
+// Insert a pattern, walking it backwards for suffix rules
+static int trie_insert(trie_t *trie, const char *pattern, int backwards) {
+    if (trie->count == 0 && add_node(trie, 0) < 0) return -1;
+
+    size_t len = strlen(pattern);
+    int node = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = pattern[backwards ? len - 1 - i : i];
+        int child = find_child(trie, node, c);
+        if (child < 0) {
+            child = add_node(trie, c);
+            if (child < 0) return -1;
+            trie->nodes[child].sibling = trie->nodes[node].child;
+            trie->nodes[node].child = child;
+        }
+        node = child;
+    }
+
+    return node;
+}
+
+// Later rules replace earlier ones with the same kind and pattern,
+// so a rules file can override the built-in set
+static int add_rule(rule_kind_t kind, const char *pattern, const char *library) {
+    if (!*pattern) return -1;
+
+    if ((rule_count & (rule_count - 1)) == 0) {
+        int capacity = rule_count ? rule_count * 2 : 1;
+        const char **tmp = realloc(libraries, capacity * sizeof(char*));
+        if (!tmp) return -1;
+        libraries = tmp;
+    }
+
+    trie_t *trie = kind == RULE_SUFFIX ? &backward : &forward;
+    int node = trie_insert(trie, pattern, kind == RULE_SUFFIX);
+    if (node < 0) return -1;
+
+    if (kind == RULE_EXACT) {
+        trie->nodes[node].exact = rule_count;
+    } else {
+        trie->nodes[node].prefix = rule_count;
+    }
+    libraries[rule_count++] = library;
+
+    unsigned char kind_byte = kind;
+    rules_hash = hash_bytes64(rules_hash, &kind_byte, 1);
+    rules_hash = hash_bytes64(rules_hash, pattern, strlen(pattern) + 1);
+    rules_hash = library ? hash_bytes64(rules_hash, library, strlen(library) + 1)
+                         : hash_bytes64(rules_hash, "-", 1);
+
+    return 0;
+}
+
+static char* keep_string(const char *str) {
+    if ((owned_count & (owned_count - 1)) == 0) {
+        int capacity = owned_count ? owned_count * 2 : 1;
+        char **tmp = realloc(owned, capacity * sizeof(char*));
+        if (!tmp) return NULL;
+        owned = tmp;
+    }
+
+    char *copy = strdup(str);
+    if (copy) owned[owned_count++] = copy;
+    return copy;
+}
+
+// Rules file: "<exact|prefix|suffix> <pattern> <library>" per line,
+// '-' as library for system headers, '#' starts a comment
+static int load_rules(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Error: cannot read rules file '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t size = 0;
+    int line_number = 0;
+    int ret = 0;
+    int loaded = 0;
+    while (getline(&line, &size, f) > 0) {
+        line_number++;
+
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char *saveptr = NULL;
+        char *kind_name = strtok_r(line, " \t\r\n", &saveptr);
+        if (!kind_name) continue;
+        char *pattern = strtok_r(NULL, " \t\r\n", &saveptr);
+        char *library = strtok_r(NULL, " \t\r\n", &saveptr);
+
+        rule_kind_t kind;
+        if (strcmp(kind_name, "exact") == 0) {
+            kind = RULE_EXACT;
+        } else if (strcmp(kind_name, "prefix") == 0) {
+            kind = RULE_PREFIX;
+        } else if (strcmp(kind_name, "suffix") == 0) {
+            kind = RULE_SUFFIX;
+        } else {
+            kind_name = NULL;
+        }
+
+        if (!kind_name || !pattern || !library || strtok_r(NULL, " \t\r\n", &saveptr)) {
+            fprintf(stderr, "Error: %s:%d: expected '<exact|prefix|suffix> <header> <library|->'\n",
+                    path, line_number);
+            ret = -1;
+            break;
+        }
+
+        const char *kept_library = NULL;
+        if (strcmp(library, "-") != 0 && !(kept_library = keep_string(library))) {
+            ret = -1;
+            break;
+        }
+        const char *kept_pattern = keep_string(pattern);
+        if (!kept_pattern || add_rule(kind, kept_pattern, kept_library) != 0) {
+            ret = -1;
+            break;
+        }
+        loaded++;
+    }
+
+    free(line);
+    fclose(f);
+
+    if (config.debug && ret == 0)
+        printf("ddn:load_rules(): loaded %d rules from '%s'\n", loaded, path);
+
+    return ret;
+}
+
+int mapping_init(const char *rules_path) {
+    mapping_free();
+
+    for (size_t i = 0; i < sizeof(builtin_rules) / sizeof(builtin_rules[0]); i++) {
+        const rule_t *rule = &builtin_rules[i];
+        if (add_rule(rule->kind, rule->pattern, rule->library) != 0) return -1;
+    }
+
+    if (rules_path && load_rules(rules_path) != 0) return -1;
+
+    if (config.debug)
+        printf("ddn:mapping_init(): %d rules, %d + %d trie nodes\n",
+               rule_count, forward.count, backward.count);
+
+    return 0;
+}
+
+static mapping_result_t get_result(int rule, const char **library) {
+    *library = libraries[rule];
+    return libraries[rule] ? MAPPING_LIBRARY : MAPPING_SYSTEM;
+}
+
+mapping_result_t mapping_lookup(const char *header, const char **library) {
+    *library = NULL;
+    if (forward.count == 0) return MAPPING_NONE;
+
+    // One pass over the header for exact and prefix rules
+    int prefix = -1;
+    int node = 0;
+    for (const char *p = header; *p; p++) {
+        node = find_child(&forward, node, (unsigned char)*p);
+        if (node < 0) break;
+        if (forward.nodes[node].prefix >= 0) prefix = forward.nodes[node].prefix;
+    }
+    if (node >= 0 && forward.nodes[node].exact >= 0)
+        return get_result(forward.nodes[node].exact, library);
+    if (prefix >= 0) return get_result(prefix, library);
+
+    // One pass backwards for suffix rules
+    if (backward.count == 0) return MAPPING_NONE;
+
+    int suffix = -1;
+    node = 0;
+    for (const char *q = header + strlen(header); q > header; q--) {
+        node = find_child(&backward, node, (unsigned char)q[-1]);
+        if (node < 0) break;
+        if (backward.nodes[node].prefix >= 0) suffix = backward.nodes[node].prefix;
+    }
+    if (suffix >= 0) return get_result(suffix, library);
+
+    return MAPPING_NONE;
+}
+
+uint64_t mapping_hash(void) {
+    return rules_hash;
+}
+
+void mapping_free(void) {
+    free(forward.nodes);
+    free(backward.nodes);
+    memset(&forward, 0, sizeof(forward));
+    memset(&backward, 0, sizeof(backward));
+
+    for (int i = 0; i < owned_count; i++) {
+        free(owned[i]);
+    }
+    free(owned);
+    free(libraries);
+    owned = NULL;
+    libraries = NULL;
+    owned_count = rule_count = 0;
+    rules_hash = HASH64_INIT;
+}
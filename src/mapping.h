@@ -0,0 +1,26 @@
+#ifndef MAPPING_H
+#define MAPPING_H 1
+
+#include <stdint.h>
+
+typedef enum {
+    MAPPING_NONE,       // No rule, the name gets guessed from the header
+    MAPPING_LIBRARY,    // Provided by a library
+    MAPPING_SYSTEM      // Part of the C library or the compiler, never queried
+} mapping_result_t;
+
+// Compile the built-in rules and those of 'rules_path' if given,
+// returns 0 on success
+int mapping_init(const char *rules_path);
+
+// Find the rule for a header: exact names first, then the longest
+// matching prefix, then the longest matching suffix
+mapping_result_t mapping_lookup(const char *header, const char **library);
+
+// Hash of the rules loaded, headers get other query names under other rules
+uint64_t mapping_hash(void);
+
+// Free the rules
+void mapping_free(void);
+
+#endif // MAPPING_H
@@ -1,15 +1,155 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <jansson.h>
 
 #include "output.h"
 #include "distro.h"
 
-void generate_install_commands(distro_packages_t *results, int count) {
-    if (!results || count <= 0) {
-        printf("No packages found.\n");
-        return;
+static const char *format_names[] = {
+    [FORMAT_MARKDOWN] = "markdown",
+    [FORMAT_JSON] = "json",
+    [FORMAT_NDJSON] = "ndjson",
+    [FORMAT_SHELL] = "shell",
+};
+
+static const char *source_names[] = {
+    [RESOLVED_NONE] = "none",
+    [RESOLVED_INDEX] = "index",
+    [RESOLVED_CACHE] = "cache",
+    [RESOLVED_QUERY] = "query",
+    [RESOLVED_FAILED] = "failed",
+};
+
+// Records streamed by the distro workers must not interleave
+static pthread_mutex_t emit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int parse_output_format(const char *name, output_format_t *format) {
+    for (size_t i = 0; i < sizeof(format_names) / sizeof(format_names[0]); i++) {
+        if (strcmp(name, format_names[i]) == 0) {
+            *format = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+FILE* progress_stream(void) {
+    return config.format == FORMAT_MARKDOWN ? stdout : stderr;
+}
+
+static const char* dependency_type_name(dependency_type_t type) {
+    switch (type) {
+        case DEP_TYPE_HEADER: return "header";
+        case DEP_TYPE_LIBRARY: return "library";
+        case DEP_TYPE_PKGCONFIG: return "pkgconfig";
+        case DEP_TYPE_DEFINE: return "define";
+    }
+    return "unknown";
+}
+
+// Install command of a distro followed by the packages, NULL without packages
+static char* build_install_line(const distro_info_t *distro, package_list_t *packages) {
+    if (!packages || packages->count == 0) return NULL;
+
+    size_t command_len = strlen(distro->install_command);
+    while (command_len > 0 && distro->install_command[command_len - 1] == ' ') command_len--;
+
+    size_t len = command_len + 1;
+    for (int i = 0; i < packages->count; i++) {
+        len += strlen(packages->items[i].name) + 1;
+    }
+
+    char *line = malloc(len);
+    if (!line) return NULL;
+
+    char *p = line;
+    memcpy(p, distro->install_command, command_len);
+    p += command_len;
+    for (int i = 0; i < packages->count; i++) {
+        p += sprintf(p, " %s", packages->items[i].name);
+    }
+
+    return line;
+}
+
+static json_t* package_array(package_list_t *packages) {
+    json_t *array = json_array();
+    for (int i = 0; packages && i < packages->count; i++) {
+        json_t *package = json_object();
+        json_object_set_new(package, "name", json_string(packages->items[i].name));
+        if (packages->items[i].confidence >= 0)
+            json_object_set_new(package, "confidence", json_integer(packages->items[i].confidence));
+        json_array_append_new(array, package);
+    }
+    return array;
+}
+
+// Everything known about one distro: its install command, and for each
+// dependency the packages it resolved to and where they came from
+static json_t* distro_record(distro_packages_t *result, dependency_list_t *deps) {
+    const distro_info_t *distro = get_distro_by_name(result->distro_name);
+    json_t *record = json_object();
+
+    json_object_set_new(record, "distro", json_string(result->distro_name));
+
+    char *install = distro ? build_install_line(distro, result->packages) : NULL;
+    json_object_set_new(record, "install", install ? json_string(install) : json_null());
+    free(install);
+
+    json_object_set_new(record, "packages", package_array(result->packages));
+    json_object_set_new(record, "elapsed_us", json_integer(result->details.elapsed / 1000));
+
+    json_t *dependencies = json_array();
+    resolution_details_t *details = &result->details;
+    for (int i = 0; i < details->count && i < deps->count; i++) {
+        json_t *dependency = json_object();
+        json_object_set_new(dependency, "name", json_string(deps->items[i].name));
+        json_object_set_new(dependency, "type", json_string(dependency_type_name(deps->items[i].type)));
+        json_object_set_new(dependency, "status", json_string(dependency_status_name(deps->items[i].status)));
+        json_object_set_new(dependency, "source", json_string(source_names[details->sources[i]]));
+        if (details->sources[i] == RESOLVED_FAILED)
+            json_object_set_new(dependency, "error",
+                                json_string(remote_failure_name(details->failures[i])));
+        json_object_set_new(dependency, "packages", package_array(details->packages[i]));
+        json_array_append_new(dependencies, dependency);
+    }
+    json_object_set_new(record, "dependencies", dependencies);
+
+    return record;
+}
+
+void emit_distro_result(distro_packages_t *result, dependency_list_t *deps) {
+    if (config.format != FORMAT_NDJSON) return;
+
+    json_t *record = distro_record(result, deps);
+
+    pthread_mutex_lock(&emit_lock);
+    json_dumpf(record, stdout, JSON_COMPACT);
+    fputc('\n', stdout);
+    fflush(stdout);
+    pthread_mutex_unlock(&emit_lock);
+
+    json_decref(record);
+}
+
+// List the dependencies whose query failed, as "<prefix> <name> (<failure>), ...",
+// returns how many there were
+static int print_failed(const char *prefix, distro_packages_t *result, dependency_list_t *deps) {
+    resolution_details_t *details = &result->details;
+    int failed = 0;
+    for (int i = 0; i < details->count && i < deps->count; i++) {
+        if (details->sources[i] != RESOLVED_FAILED) continue;
+        printf("%s %s (%s)", failed ? "," : prefix, deps->items[i].name,
+               remote_failure_name(details->failures[i]));
+        failed++;
     }
+    if (failed) printf("\n");
+    return failed;
+}
 
+static void print_markdown(distro_packages_t *results, int count, dependency_list_t *deps) {
     printf("## Dependency Installation Commands\n\n");
 
     for (int i = 0; i < count; i++) {
@@ -19,6 +159,7 @@ void generate_install_commands(distro_packages_t *results, int count) {
         if (!packages || packages->count == 0) {
             printf("### %s\n", distro_name);
             printf("No packages found or VM not configured.\n\n");
+            if (print_failed("Failed:", &results[i], deps)) printf("\n");
             continue;
         }
 
@@ -35,5 +176,85 @@ void generate_install_commands(distro_packages_t *results, int count) {
         }
 
         printf("\n```\n\n");
+
+        // With --exact, point out the packages worth checking by hand
+        int uncertain = 0;
+        for (int j = 0; j < packages->count; j++) {
+            package_t *package = &packages->items[j];
+            if (package->confidence < 0 || package->confidence >= 100) continue;
+            printf("%s %s (%d%%)", uncertain ? "," : "Uncertain:", package->name,
+                   package->confidence);
+            uncertain++;
+        }
+        if (uncertain) printf("\n\n");
+
+        // Failed queries aren't cached, running again may resolve them
+        if (print_failed("Failed:", &results[i], deps)) printf("\n");
+    }
+}
+
+static void print_json(distro_packages_t *results, int count, dependency_list_t *deps) {
+    json_t *document = json_object();
+    json_t *distros = json_array();
+    for (int i = 0; i < count; i++) {
+        json_array_append_new(distros, distro_record(&results[i], deps));
+    }
+    json_object_set_new(document, "dependency_count", json_integer(deps->count));
+    json_object_set_new(document, "distros", distros);
+
+    json_dumpf(document, stdout, JSON_INDENT(2));
+    fputc('\n', stdout);
+    json_decref(document);
+}
+
+// A script installing the packages of whichever distro it runs on,
+// matched on the ID of /etc/os-release
+static void print_shell(distro_packages_t *results, int count, dependency_list_t *deps) {
+    printf("#!/bin/sh\n");
+    printf("# Generated by distro-dep-name\n");
+    printf(". /etc/os-release\n");
+    printf("case \"$ID\" in\n");
+
+    for (int i = 0; i < count; i++) {
+        const distro_info_t *distro = get_distro_by_name(results[i].distro_name);
+        if (!distro) continue;
+
+        char *install = build_install_line(distro, results[i].packages);
+        printf("    %s|%s-*)\n", distro->name, distro->name);
+        print_failed("        # Failed:", &results[i], deps);
+        if (install)
+            printf("        %s\n", install);
+        else
+            printf("        echo \"No packages found for %s\" >&2\n", distro->name);
+        printf("        ;;\n");
+        free(install);
+    }
+
+    printf("    *)\n");
+    printf("        echo \"Unsupported distro: $ID\" >&2\n");
+    printf("        exit 1\n");
+    printf("        ;;\n");
+    printf("esac\n");
+}
+
+void generate_install_commands(distro_packages_t *results, int count, dependency_list_t *deps) {
+    if (!results || count <= 0) {
+        if (config.format == FORMAT_MARKDOWN) printf("No packages found.\n");
+        return;
+    }
+
+    switch (config.format) {
+        case FORMAT_MARKDOWN:
+            print_markdown(results, count, deps);
+            break;
+        case FORMAT_JSON:
+            print_json(results, count, deps);
+            break;
+        case FORMAT_NDJSON:
+            // Streamed by emit_distro_result() already
+            break;
+        case FORMAT_SHELL:
+            print_shell(results, count, deps);
+            break;
     }
 }
@@ -1,14 +1,27 @@
 #ifndef OUTPUT_H
 #define OUTPUT_H 1
 
+#include <stdio.h>
+
+#include "ddn_config.h"
 #include "vm_query.h"
 
 typedef struct {
     const char *distro_name;
     package_list_t *packages;
+    resolution_details_t details;
 } distro_packages_t;
 
+// Get an output format from its --format name, returns 0 on success
+int parse_output_format(const char *name, output_format_t *format);
+
+// Where progress messages go: stdout for Markdown, stderr when stdout carries data
+FILE* progress_stream(void);
+
+// Write a distro's record as soon as it's resolved, only with --format ndjson
+void emit_distro_result(distro_packages_t *result, dependency_list_t *deps);
+
 // Generate install commands for all distros
-void generate_install_commands(distro_packages_t *results, int count);
+void generate_install_commands(distro_packages_t *results, int count, dependency_list_t *deps);
 
 #endif // OUTPUT_H
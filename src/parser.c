@@ -3,37 +3,96 @@
 #include <string.h>
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
-#include <ctype.h>
 
 #include "ddn_config.h"
 #include "parser.h"
+#include "buildfiles.h"
+#include "hash.h"
+#include "pool.h"
+#include "preproc.h"
+#include "stats.h"
 
 #define INITIAL_CAPACITY 32
+#define PARSE_CHUNKS_PER_THREAD 8
+#define SMALL_FILE_SIZE 65536
+#define MANIFEST_NAME ".ddn-manifest"
+#define MANIFEST_VERSION 3
 
-static dependency_list_t* create_dependency_list(void) {
+dependency_list_t* create_dependency_list(void) {
     dependency_list_t *list = malloc(sizeof(dependency_list_t));
     if (!list) return NULL;
 
     list->items = malloc(INITIAL_CAPACITY * sizeof(dependency_t));
-    if (!list->items) {
+    list->buckets = malloc(INITIAL_CAPACITY * 2 * sizeof(int));
+    if (!list->items || !list->buckets) {
+        free(list->items);
+        free(list->buckets);
         free(list);
         return NULL;
     }
+    memset(list->buckets, 0xff, INITIAL_CAPACITY * 2 * sizeof(int));
 
     list->count = 0;
     list->capacity = INITIAL_CAPACITY;
+    list->bucket_count = INITIAL_CAPACITY * 2;
+    list->names = (arena_t){0};
     return list;
 }
 
-void add_dependency(dependency_list_t *list, const char *name, dependency_type_t type) {
-    if (!list || !name) return;
+static uint32_t dependency_hash(const char *name, size_t len, dependency_type_t type) {
+    uint32_t hash = hash_bytes(HASH_INIT, name, len);
+    return hash_bytes(hash, &type, sizeof(type));
+}
+
+// Get the bucket holding a dependency, or the empty bucket where it would go
+static int find_bucket(dependency_list_t *list, const char *name, size_t len, dependency_type_t type) {
+    int mask = list->bucket_count - 1;
+    int bucket = dependency_hash(name, len, type) & mask;
+
+    while (list->buckets[bucket] >= 0) {
+        dependency_t *dep = &list->items[list->buckets[bucket]];
+        if (dep->type == type && strncmp(dep->name, name, len) == 0 && dep->name[len] == '\0')
+            break;
+        bucket = (bucket + 1) & mask;
+    }
+
+    return bucket;
+}
+
+// Double the index size and insert all the items again
+static int grow_buckets(dependency_list_t *list) {
+    int bucket_count = list->bucket_count * 2;
+    int *buckets = malloc(bucket_count * sizeof(int));
+    if (!buckets) return -1;
+    memset(buckets, 0xff, bucket_count * sizeof(int));
+
+    free(list->buckets);
+    list->buckets = buckets;
+    list->bucket_count = bucket_count;
 
-    // Check for duplicates
     for (int i = 0; i < list->count; i++) {
-        if (strcmp(list->items[i].name, name) == 0 && list->items[i].type == type) {
-            return; // Already exists
-        }
+        dependency_t *dep = &list->items[i];
+        list->buckets[find_bucket(list, dep->name, strlen(dep->name), dep->type)] = i;
+    }
+
+    return 0;
+}
+
+// Add a dependency whose name isn't NUL-terminated,
+// it only gets copied if it's not in the list yet
+static void add_dependency_len(dependency_list_t *list, const char *name, size_t len,
+                               dependency_type_t type, dependency_status_t status) {
+    // Check for duplicates
+    int bucket = find_bucket(list, name, len, type);
+    if (list->buckets[bucket] >= 0) {
+        dependency_t *dep = &list->items[list->buckets[bucket]];
+        if (status < dep->status) dep->status = status;
+        return; // Already exists
     }
 
     // Expand capacity if needed
@@ -43,147 +102,336 @@ void add_dependency(dependency_list_t *list, const char *name, dependency_type_t
         if (!list->items) return;
     }
 
-    list->items[list->count].name = strdup(name);
+    char *copy = arena_strndup(&list->names, name, len);
+    if (!copy) return;
+
+    list->items[list->count].name = copy;
     list->items[list->count].type = type;
+    list->items[list->count].status = status;
+    list->buckets[bucket] = list->count;
     list->count++;
+
+    // Keep the index at most half full
+    if (list->count * 2 > list->bucket_count)
+        grow_buckets(list);
 }
 
-void free_dependency_list(dependency_list_t *list) {
-    if (!list) return;
+void add_dependency(dependency_list_t *list, const char *name, dependency_type_t type) {
+    if (!list || !name) return;
+
+    add_dependency_len(list, name, strlen(name), type, DEP_REQUIRED);
+}
+
+void add_dependency_status(dependency_list_t *list, const char *name, dependency_type_t type,
+                           dependency_status_t status) {
+    if (!list || !name) return;
+
+    add_dependency_len(list, name, strlen(name), type, status);
+}
+
+dependency_list_t* select_dependencies(dependency_list_t *list, dependency_status_t weakest) {
+    dependency_list_t *selected = create_dependency_list();
+    if (!selected || !list) return selected;
 
     for (int i = 0; i < list->count; i++) {
-        free(list->items[i].name);
+        dependency_t *dep = &list->items[i];
+        if (dep->status <= weakest)
+            add_dependency_status(selected, dep->name, dep->type, dep->status);
+    }
+
+    return selected;
+}
+
+int find_dependency(dependency_list_t *list, const char *name, dependency_type_t type) {
+    if (!list || !name) return -1;
+
+    return list->buckets[find_bucket(list, name, strlen(name), type)];
+}
+
+char dependency_type_char(dependency_type_t type) {
+    switch (type) {
+        case DEP_TYPE_HEADER: return 'h';
+        case DEP_TYPE_LIBRARY: return 'l';
+        case DEP_TYPE_PKGCONFIG: return 'p';
+        case DEP_TYPE_DEFINE: return 'd';
+    }
+    return '?';
+}
+
+int dependency_type_from_char(char c, dependency_type_t *type) {
+    switch (c) {
+        case 'h': *type = DEP_TYPE_HEADER; return 0;
+        case 'l': *type = DEP_TYPE_LIBRARY; return 0;
+        case 'p': *type = DEP_TYPE_PKGCONFIG; return 0;
+        case 'd': *type = DEP_TYPE_DEFINE; return 0;
+    }
+    return -1;
+}
+
+const char* dependency_status_name(dependency_status_t status) {
+    switch (status) {
+        case DEP_REQUIRED: return "required";
+        case DEP_OPTIONAL: return "optional";
+        case DEP_EXCLUDED: return "excluded";
     }
+    return "unknown";
+}
+
+// Letters standing for the statuses in the manifest, in status order
+static const char status_chars[] = "rox";
+
+static int dependency_status_from_char(char c, dependency_status_t *status) {
+    const char *found = c ? strchr(status_chars, c) : NULL;
+    if (!found) return -1;
+
+    *status = found - status_chars;
+    return 0;
+}
+
+void free_dependency_list(dependency_list_t *list) {
+    if (!list) return;
+
+    arena_free(&list->names);
     free(list->items);
+    free(list->buckets);
     free(list);
 }
 
-// Parse #include statements from C/C++ files
-static void parse_c_file(const char *filepath, dependency_list_t *list) {
-    if (config.debug)
-        printf("ddn:parse_c_file(): parsing '%s'\n", filepath);
-
-    FILE *f = fopen(filepath, "r");
-    if (!f) return;
-
-    char line[1024];
-    while (fgets(line, sizeof(line), f)) {
-        // Skip whitespace
-        char *p = line;
-        while (*p && isspace(*p)) p++;
-
-        // Check for #include
-        if (*p == '#') {
-            p++;
-            while (*p && isspace(*p)) p++;
-
-            if (strncmp(p, "include", 7) == 0) {
-                p += 7;
-                while (*p && isspace(*p)) p++;
-
-                // Extract header name
-                char *start = NULL;
-                char *end = NULL;
-
-                if (*p == '<') {
-                    start = p + 1;
-                    end = strchr(start, '>');
-                } /* ignore local headers
-                else if (*p == '"') {
-                    start = p + 1;
-                    end = strchr(start, '"');
-                } */
-
-                if (start && end) {
-                    size_t len = end - start;
-                    char *header = malloc(len + 1);
-                    strncpy(header, start, len);
-                    header[len] = '\0';
-
-                    if (config.debug) printf("  found header '%s'\n", header);
-                    add_dependency(list, header, DEP_TYPE_HEADER);
-                    free(header);
+// Get the end of the line starting at p
+static const char* line_end(const char *p, const char *end) {
+    const char *eol = memchr(p, '\n', end - p);
+    return eol ? eol : end;
+}
+
+// Find the #include <...> directives in a file's contents. memchr() jumps from
+// one '#' to the next, so lines without a directive are never looked at one
+// character at a time, and header names are added straight from the buffer.
+// The other directives go to 'pp', which tells whether the headers are
+// in conditional blocks the target compiles.
+static void scan_includes(const char *data, size_t size, dependency_list_t *list,
+                          preproc_state_t *pp) {
+    const char *p = data;
+    const char *end = data + size;
+    long includes = 0;
+
+    while (p < end) {
+        const char *hash = memchr(p, '#', end - p);
+        if (!hash) break;
+
+        // Only directives: nothing but blanks before the '#' on its line
+        const char *q = hash;
+        while (q > data && (q[-1] == ' ' || q[-1] == '\t')) q--;
+        if (q > data && q[-1] != '\n') {
+            p = hash + 1;
+            continue;
+        }
+
+        const char *eol = line_end(hash, end);
+        q = hash + 1;
+        while (q < eol && (*q == ' ' || *q == '\t')) q++;
+
+        if (eol - q > 7 && memcmp(q, "include", 7) == 0) {
+            q += 7;
+            while (q < eol && (*q == ' ' || *q == '\t')) q++;
+
+            // Extract header name, local "..." headers are ignored
+            if (q < eol && *q == '<') {
+                const char *start = q + 1;
+                const char *close = memchr(start, '>', eol - start);
+                if (close && close > start) {
+                    dependency_status_t status = preproc_status(pp);
+                    if (config.debug)
+                        printf("  found header '%.*s' (%s)\n", (int)(close - start), start,
+                               dependency_status_name(status));
+                    add_dependency_len(list, start, close - start, DEP_TYPE_HEADER, status);
+                    includes++;
                 }
             }
+        } else {
+            // Conditions and macro definitions may go on after a backslash
+            while (eol < end && (eol[-1] == '\\' || (eol[-1] == '\r' && eol[-2] == '\\')))
+                eol = line_end(eol + 1, end);
+            preproc_directive(pp, q, eol);
         }
+
+        p = eol + 1;
     }
 
-    fclose(f);
+    stats_add(STAT_INCLUDES, includes);
 }
 
-// Parse -l flags from Makefile
-static void parse_makefile(const char *filepath, dependency_list_t *list) {
-    if (config.debug)
-        printf("ddn:parse_makefile(): parsing '%s'\n", filepath);
+// Contents of a source file, read into a buffer or mapped
+typedef struct {
+    const char *data;
+    size_t size;
+    char *buffer;
+    void *map;
+} file_data_t;
 
-    FILE *f = fopen(filepath, "r");
-    if (!f) return;
+// Load a file's contents, returns 0 on success
+static int load_file(const char *filepath, file_data_t *file) {
+    memset(file, 0, sizeof(file_data_t));
 
-    char line[2048];
-    while (fgets(line, sizeof(line), f)) {
-        char *p = line;
+    int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
 
-        // Look for -l flags
-        while ((p = strstr(p, "-l"))) {
-            p += 2;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    if (size == 0) {
+        close(fd);
+        file->data = "";
+        return 0;
+    }
 
-            // Extract library name
-            char libname[256] = {0};
-            int i = 0;
-            while (*p && (isalnum(*p) || *p == '_' || *p == '-') && i < 255) {
-                libname[i++] = *p++;
-            }
+    // Small files are cheaper to read than to map
+    if (size <= SMALL_FILE_SIZE) {
+        file->buffer = malloc(size);
+        if (!file->buffer) {
+            close(fd);
+            return -1;
+        }
 
-            if (i > 0) {
-                if (config.debug) printf("  found library '%s'\n", libname);
-                add_dependency(list, libname, DEP_TYPE_LIBRARY);
-            }
+        ssize_t nread;
+        while (file->size < size && (nread = read(fd, file->buffer + file->size, size - file->size)) > 0) {
+            file->size += nread;
         }
+        close(fd);
+        file->data = file->buffer;
+        return 0;
     }
 
-    fclose(f);
+    file->map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file->map == MAP_FAILED) {
+        file->map = NULL;
+        return -1;
+    }
+
+    madvise(file->map, size, MADV_SEQUENTIAL);
+    file->data = file->map;
+    file->size = size;
+    return 0;
 }
 
-// Recursively scan directory for source files and Makefiles
-static void scan_directory(const char *path, dependency_list_t *list) {
-    if (config.debug)
-        printf("ddn:scan_directory(): scanning '%s'\n", path);
+static void unload_file(file_data_t *file) {
+    if (file->map) munmap(file->map, file->size);
+    free(file->buffer);
+}
 
-    struct stat st;
-    if (stat(path, &st) != 0) return;
-    if (config.debug)
-        printf("ddn:scan_directory(): stat() ok\n");
+typedef enum {
+    SOURCE_NONE,
+    SOURCE_C,           // C/C++ source or header
+    SOURCE_MAKEFILE,
+    SOURCE_CMAKE,       // CMakeLists.txt or *.cmake
+    SOURCE_MESON,       // meson.build
+    SOURCE_AUTOCONF     // configure.ac
+} source_kind_t;
+
+// File found by the directory walk, or recorded in the manifest
+typedef struct {
+    char *path;
+    source_kind_t kind;
+    struct timespec mtime;
+    off_t size;
+    uint64_t hash;              // Hash of the contents
+    dependency_t *deps;         // Dependencies found in this file
+    int dep_count;
+    int parsed;                 // Contents scanned during this run
+} source_file_t;
+
+// Shared state of the directory walk: a stack of directories still to
+// scan, taken by whichever worker is free, and the files found so far
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char **dirs;
+    int dir_count;
+    int dir_capacity;
+    int busy;           // Workers currently scanning a directory
+    source_file_t *files;
+    int file_count;
+    int file_capacity;
+} walk_t;
+
+static source_kind_t get_source_kind(const char *filename) {
+    const char *ext = strrchr(filename, '.');
+    if (ext) {
+        if (strcmp(ext, ".c") == 0 || strcmp(ext, ".h") == 0 ||
+            strcmp(ext, ".cpp") == 0 || strcmp(ext, ".cc") == 0 ||
+            strcmp(ext, ".cxx") == 0 || strcmp(ext, ".hpp") == 0) {
+            return SOURCE_C;
+        }
+        if (strcmp(ext, ".mk") == 0) return SOURCE_MAKEFILE;
+        if (strcmp(ext, ".cmake") == 0) return SOURCE_CMAKE;
+    }
 
-    if (S_ISREG(st.st_mode)) {
-        // Single file
-        const char *ext = strrchr(path, '.');
-        if (ext) {
-            if (config.debug) printf("ddn:scan_directory(): got ext '%s'\n", ext);
-            if (strcmp(ext, ".c") == 0 || strcmp(ext, ".h") == 0 ||
-                strcmp(ext, ".cpp") == 0 || strcmp(ext, ".cc") == 0 ||
-                strcmp(ext, ".cxx") == 0 || strcmp(ext, ".hpp") == 0) {
-                parse_c_file(path, list);
-            }
+    if (strcmp(filename, "Makefile") == 0 || strcmp(filename, "makefile") == 0 ||
+        strcmp(filename, "GNUmakefile") == 0 || strcmp(filename, "Makefile.am") == 0) {
+        return SOURCE_MAKEFILE;
+    }
+    if (strcmp(filename, "CMakeLists.txt") == 0) return SOURCE_CMAKE;
+    if (strcmp(filename, "meson.build") == 0) return SOURCE_MESON;
+    if (strcmp(filename, "configure.ac") == 0 || strcmp(filename, "configure.in") == 0) {
+        return SOURCE_AUTOCONF;
+    }
+
+    return SOURCE_NONE;
+}
+
+// Called with the walk lock held
+static void push_directory(walk_t *walk, char *path) {
+    if (walk->dir_count >= walk->dir_capacity) {
+        int capacity = walk->dir_capacity ? walk->dir_capacity * 2 : INITIAL_CAPACITY;
+        char **dirs = realloc(walk->dirs, capacity * sizeof(char*));
+        if (!dirs) {
+            free(path);
+            return;
         }
+        walk->dirs = dirs;
+        walk->dir_capacity = capacity;
+    }
 
-        const char *filename = strrchr(path, '/');
-        filename = filename ? filename + 1 : path;
-        if (strcmp(filename, "Makefile") == 0 || strcmp(filename, "makefile") == 0) {
-            parse_makefile(path, list);
+    walk->dirs[walk->dir_count++] = path;
+    pthread_cond_signal(&walk->cond);
+}
+
+// Called with the walk lock held
+static void push_file(walk_t *walk, char *path, source_kind_t kind) {
+    if (walk->file_count >= walk->file_capacity) {
+        int capacity = walk->file_capacity ? walk->file_capacity * 2 : INITIAL_CAPACITY;
+        source_file_t *files = realloc(walk->files, capacity * sizeof(source_file_t));
+        if (!files) {
+            free(path);
+            return;
         }
-        return;
+        walk->files = files;
+        walk->file_capacity = capacity;
     }
 
-    if (!S_ISDIR(st.st_mode)) return;
+    source_file_t *file = &walk->files[walk->file_count++];
+    memset(file, 0, sizeof(source_file_t));
+    file->path = path;
+    file->kind = kind;
+}
+
+// Scan one directory for source files and Makefiles, subdirectories go back to the walk.
+// The entry type from readdir() is used when available, avoiding a stat() per entry.
+static void scan_directory(walk_t *walk, const char *path) {
+    if (config.debug)
+        printf("ddn:scan_directory(): scanning '%s'\n", path);
 
-    DIR *dir = opendir(path);
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
     if (!dir) {
         if (config.debug)
             printf("ddn:scan_directory(): (subdir) opendir() failed: %s\n", strerror(errno));
-
+        if (fd >= 0) close(fd);
         return;
     }
-    if (config.debug) printf("ddn:scan_directory(): (subdir) opendir() ok\n");
 
     struct dirent *entry;
     while ((entry = readdir(dir))) {
@@ -191,34 +439,341 @@ static void scan_directory(const char *path, dependency_list_t *list) {
             continue;
         }
 
-        char filepath[1024];
-        snprintf(filepath, sizeof(filepath), "%s/%s", path, entry->d_name);
-
-        struct stat entry_st;
-        if (stat(filepath, &entry_st) != 0) continue;
-        if (config.debug) printf("ddn:scan_directory(): (subdir) stat() ok\n");
-
-        if (S_ISDIR(entry_st.st_mode)) {
-            scan_directory(filepath, list);
-        } else if (S_ISREG(entry_st.st_mode)) {
-            if (config.debug) printf("ddn:scan_directory(): (subdir) regular file found\n");
-            const char *ext = strrchr(entry->d_name, '.');
-            if (ext) {
-                if (config.debug) printf("ddn:scan_directory(): (subdir) ext '%s'\n", ext);
-                if (strcmp(ext, ".c") == 0 || strcmp(ext, ".h") == 0 ||
-                    strcmp(ext, ".cpp") == 0 || strcmp(ext, ".cc") == 0 ||
-                    strcmp(ext, ".cxx") == 0 || strcmp(ext, ".hpp") == 0) {
-                    parse_c_file(filepath, list);
-                }
+        int is_dir = entry->d_type == DT_DIR;
+        int is_reg = entry->d_type == DT_REG;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            struct stat entry_st;
+            if (fstatat(fd, entry->d_name, &entry_st, 0) != 0) continue;
+            is_dir = S_ISDIR(entry_st.st_mode);
+            is_reg = S_ISREG(entry_st.st_mode);
+        }
+
+        source_kind_t kind = is_reg ? get_source_kind(entry->d_name) : SOURCE_NONE;
+        if (!is_dir && kind == SOURCE_NONE) continue;
+
+        char *filepath = NULL;
+        if (asprintf(&filepath, "%s/%s", path, entry->d_name) < 0) continue;
+
+        pthread_mutex_lock(&walk->lock);
+        if (is_dir)
+            push_directory(walk, filepath);
+        else
+            push_file(walk, filepath, kind);
+        pthread_mutex_unlock(&walk->lock);
+    }
+
+    closedir(dir);
+}
+
+// Take directories from the walk until none are left and no other worker
+// can add more
+static void walk_worker(int index, void *arg) {
+    (void)index;
+    walk_t *walk = arg;
+
+    pthread_mutex_lock(&walk->lock);
+    while (1) {
+        while (walk->dir_count == 0 && walk->busy > 0) {
+            pthread_cond_wait(&walk->cond, &walk->lock);
+        }
+        if (walk->dir_count == 0) break;
+
+        char *path = walk->dirs[--walk->dir_count];
+        walk->busy++;
+        pthread_mutex_unlock(&walk->lock);
+
+        scan_directory(walk, path);
+        free(path);
+
+        pthread_mutex_lock(&walk->lock);
+        walk->busy--;
+        if (walk->dir_count == 0 && walk->busy == 0)
+            pthread_cond_broadcast(&walk->cond);
+    }
+    pthread_mutex_unlock(&walk->lock);
+}
+
+static int compare_files(const void *a, const void *b) {
+    return strcmp(((const source_file_t*)a)->path, ((const source_file_t*)b)->path);
+}
+
+static void free_source_files(source_file_t *files, int count) {
+    for (int i = 0; i < count; i++) {
+        free(files[i].path);
+        free(files[i].deps);
+    }
+    free(files);
+}
+
+// Get the manifest path: the one given, or .ddn-manifest in the source directory
+static char* get_manifest_path(const char *source_path) {
+    if (config.manifest_path) return strdup(config.manifest_path);
+
+    char *path = NULL;
+    struct stat st;
+    if (stat(source_path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        if (asprintf(&path, "%s/%s", source_path, MANIFEST_NAME) < 0) path = NULL;
+    } else {
+        const char *slash = strrchr(source_path, '/');
+        int dir_len = slash ? (int)(slash - source_path) : 1;
+        if (asprintf(&path, "%.*s/%s", dir_len, slash ? source_path : ".", MANIFEST_NAME) < 0)
+            path = NULL;
+    }
+
+    return path;
+}
+
+// Load the file records of a manifest, sorted by path, the dependency names
+// are stored in 'names' and the hash of the macros they were found with in 'macros'
+static source_file_t* load_manifest(const char *path, int *count, arena_t *names,
+                                    uint64_t *macros) {
+    *count = 0;
+
+    FILE *f = fopen(path, "r");
+    if (!f) return NULL;
+
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    int version = 0;
+    unsigned long long macros_hash = 0;
+    if (getline(&line, &size, f) <= 0 ||
+        sscanf(line, "ddn-manifest %d %llx", &version, &macros_hash) != 2 ||
+        version != MANIFEST_VERSION) {
+        if (config.debug)
+            printf("ddn:load_manifest(): ignoring '%s' (version %d)\n", path, version);
+        free(line);
+        fclose(f);
+        return NULL;
+    }
+
+    source_file_t *files = NULL;
+    int capacity = 0;
+    source_file_t *file = NULL;
+    while ((len = getline(&line, &size, f)) > 0) {
+        if (line[len - 1] == '\n') line[--len] = '\0';
+
+        // F\t<mtime sec>.<nsec>\t<size>\t<hash>\t<kind>\t<path>
+        if (line[0] == 'F' && line[1] == '\t') {
+            long long sec, nsec, fsize;
+            unsigned long long hash;
+            int kind, offset = 0;
+            if (sscanf(line + 2, "%lld.%lld\t%lld\t%llx\t%d\t%n", &sec, &nsec, &fsize,
+                       &hash, &kind, &offset) != 5 || offset == 0)
+                continue;
+
+            if (*count >= capacity) {
+                capacity = capacity ? capacity * 2 : INITIAL_CAPACITY;
+                source_file_t *tmp = realloc(files, capacity * sizeof(source_file_t));
+                if (!tmp) break;
+                files = tmp;
             }
 
-            if (strcmp(entry->d_name, "Makefile") == 0 || strcmp(entry->d_name, "makefile") == 0) {
-                parse_makefile(filepath, list);
+            file = &files[(*count)++];
+            memset(file, 0, sizeof(source_file_t));
+            file->path = strdup(line + 2 + offset);
+            file->kind = kind;
+            file->mtime.tv_sec = sec;
+            file->mtime.tv_nsec = nsec;
+            file->size = fsize;
+            file->hash = hash;
+            continue;
+        }
+
+        // D\t<type>\t<status>\t<name>, belongs to the last file
+        dependency_type_t type;
+        dependency_status_t status;
+        if (file && len > 6 && line[0] == 'D' && line[1] == '\t' && line[3] == '\t' &&
+            line[5] == '\t' && dependency_type_from_char(line[2], &type) == 0 &&
+            dependency_status_from_char(line[4], &status) == 0) {
+            if ((file->dep_count & (file->dep_count - 1)) == 0) {
+                int dep_capacity = file->dep_count ? file->dep_count * 2 : 1;
+                dependency_t *tmp = realloc(file->deps, dep_capacity * sizeof(dependency_t));
+                if (!tmp) continue;
+                file->deps = tmp;
             }
+            file->deps[file->dep_count].name = arena_strndup(names, line + 6, len - 6);
+            if (!file->deps[file->dep_count].name) continue;
+            file->deps[file->dep_count].type = type;
+            file->deps[file->dep_count].status = status;
+            file->dep_count++;
         }
     }
 
-    closedir(dir);
+    free(line);
+    fclose(f);
+
+    qsort(files, *count, sizeof(source_file_t), compare_files);
+    *macros = macros_hash;
+
+    if (config.debug)
+        printf("ddn:load_manifest(): loaded %d files from '%s'\n", *count, path);
+
+    return files;
+}
+
+static int save_manifest(const char *path, source_file_t *files, int count, uint64_t macros) {
+    char *tmp_path = NULL;
+    if (asprintf(&tmp_path, "%s.%d.tmp", path, (int)getpid()) < 0) return -1;
+
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        free(tmp_path);
+        return -1;
+    }
+
+    fprintf(f, "ddn-manifest %d %016llx\n", MANIFEST_VERSION, (unsigned long long)macros);
+    for (int i = 0; i < count; i++) {
+        source_file_t *file = &files[i];
+        fprintf(f, "F\t%lld.%09ld\t%lld\t%016llx\t%d\t%s\n",
+                (long long)file->mtime.tv_sec, file->mtime.tv_nsec, (long long)file->size,
+                (unsigned long long)file->hash, file->kind, file->path);
+        for (int j = 0; j < file->dep_count; j++) {
+            dependency_t *dep = &file->deps[j];
+            fprintf(f, "D\t%c\t%c\t%s\n", dependency_type_char(dep->type),
+                    status_chars[dep->status], dep->name);
+        }
+    }
+
+    int ret = 0;
+    if (fclose(f) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        ret = -1;
+    }
+    free(tmp_path);
+
+    return ret;
+}
+
+// Files parsed by the workers, in contiguous chunks
+typedef struct {
+    source_file_t *files;
+    source_file_t **previous;   // Manifest record of each file, or NULL
+    dependency_list_t **scratch;    // Scratch list of each chunk, holding the names
+                                    // of its files' dependencies until the merge
+    int file_count;
+    int chunk_size;
+    int c_files;                // Parsing the C files, or the build files
+} parse_jobs_t;
+
+// Take over the dependencies recorded for a file in the manifest
+static void reuse_previous(source_file_t *file, source_file_t *previous) {
+    file->hash = previous->hash;
+    file->deps = previous->deps;
+    file->dep_count = previous->dep_count;
+    previous->deps = NULL;
+    previous->dep_count = 0;
+}
+
+// Parse a file unless the manifest shows it didn't change, the dependencies
+// get collected in 'scratch' and then moved to the file record
+static void parse_source_file(source_file_t *file, source_file_t *previous,
+                              dependency_list_t *scratch, preproc_state_t *pp) {
+    struct stat st;
+    if (stat(file->path, &st) != 0) return;
+    file->mtime = st.st_mtim;
+    file->size = st.st_size;
+
+    if (previous && previous->kind == file->kind && previous->size == file->size &&
+        previous->mtime.tv_sec == file->mtime.tv_sec &&
+        previous->mtime.tv_nsec == file->mtime.tv_nsec) {
+        reuse_previous(file, previous);
+        return;
+    }
+
+    file_data_t data;
+    if (load_file(file->path, &data) != 0) return;
+    file->hash = hash_bytes64(HASH64_INIT, data.data, data.size);
+    stats_add(STAT_BYTES_READ, data.size);
+
+    // Touched but not modified
+    if (previous && previous->kind == file->kind && previous->hash == file->hash) {
+        unload_file(&data);
+        reuse_previous(file, previous);
+        return;
+    }
+
+    file->parsed = 1;
+    if (file->kind == SOURCE_C) {
+        if (config.debug)
+            printf("ddn:parse_c_file(): parsing '%s'\n", file->path);
+        preproc_state_reset(pp);
+        scan_includes(data.data, data.size, scratch, pp);
+    } else if (file->kind == SOURCE_MAKEFILE) {
+        if (config.debug)
+            printf("ddn:parse_makefile(): parsing '%s'\n", file->path);
+        scan_makefile(data.data, data.size, scratch);
+    } else if (file->kind == SOURCE_CMAKE) {
+        if (config.debug)
+            printf("ddn:parse_cmake(): parsing '%s'\n", file->path);
+        scan_cmake(data.data, data.size, scratch);
+    } else if (file->kind == SOURCE_MESON) {
+        if (config.debug)
+            printf("ddn:parse_meson(): parsing '%s'\n", file->path);
+        scan_meson(data.data, data.size, scratch);
+    } else if (file->kind == SOURCE_AUTOCONF) {
+        if (config.debug)
+            printf("ddn:parse_autoconf(): parsing '%s'\n", file->path);
+        scan_autoconf(data.data, data.size, scratch);
+    }
+    unload_file(&data);
+
+    if (scratch->count > 0) {
+        file->deps = malloc(scratch->count * sizeof(dependency_t));
+        if (file->deps) {
+            memcpy(file->deps, scratch->items, scratch->count * sizeof(dependency_t));
+            file->dep_count = scratch->count;
+        }
+    }
+
+    // The names stay in the scratch list's arena, only the index is reset
+    scratch->count = 0;
+    memset(scratch->buckets, 0xff, scratch->bucket_count * sizeof(int));
+}
+
+static void parse_worker(int index, void *arg) {
+    parse_jobs_t *jobs = arg;
+    if (!jobs->scratch[index])
+        jobs->scratch[index] = create_dependency_list();
+    dependency_list_t *scratch = jobs->scratch[index];
+    if (!scratch) return;
+
+    preproc_state_t *pp = NULL;
+    if (jobs->c_files && !(pp = preproc_state_create())) return;
+
+    int start = index * jobs->chunk_size;
+    int end = start + jobs->chunk_size;
+    if (end > jobs->file_count) end = jobs->file_count;
+
+    for (int i = start; i < end; i++) {
+        if ((jobs->files[i].kind == SOURCE_C) != jobs->c_files) continue;
+        parse_source_file(&jobs->files[i], jobs->previous ? jobs->previous[i] : NULL, scratch, pp);
+    }
+
+    preproc_state_free(pp);
+}
+
+// Threads walking and parsing: --jobs, but no more than there are CPUs
+static int get_parse_jobs(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int jobs = config.jobs > 0 ? config.jobs : 1;
+    return cpus > 0 && cpus < jobs ? (int)cpus : jobs;
+}
+
+// Match the files found with the manifest records, both sorted by path
+static source_file_t** match_manifest(source_file_t *files, int file_count,
+                                      source_file_t *manifest, int manifest_count) {
+    source_file_t **previous = calloc(file_count + 1, sizeof(source_file_t*));
+    if (!previous) return NULL;
+
+    int j = 0;
+    for (int i = 0; i < file_count && j < manifest_count; i++) {
+        int cmp = -1;
+        while (j < manifest_count && (cmp = strcmp(manifest[j].path, files[i].path)) < 0) j++;
+        if (j < manifest_count && cmp == 0) previous[i] = &manifest[j++];
+    }
+
+    return previous;
 }
 
 dependency_list_t* parse_dependencies(const char *path) {
@@ -233,7 +788,118 @@ dependency_list_t* parse_dependencies(const char *path) {
         return NULL;
     }
 
-    scan_directory(path, list);
+    struct stat st;
+    if (stat(path, &st) != 0) return list;
+
+    walk_t walk = {0};
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.cond, NULL);
+
+    int threads = get_parse_jobs();
+    if (S_ISREG(st.st_mode)) {
+        // Single file
+        const char *filename = strrchr(path, '/');
+        filename = filename ? filename + 1 : path;
+        source_kind_t kind = get_source_kind(filename);
+        if (kind != SOURCE_NONE)
+            push_file(&walk, strdup(path), kind);
+    } else if (S_ISDIR(st.st_mode)) {
+        long long start = stats_begin();
+        push_directory(&walk, strdup(path));
+        pool_run(threads, threads, walk_worker, &walk);
+        stats_end(SPAN_WALK, start, path);
+    }
+
+    pthread_mutex_destroy(&walk.lock);
+    pthread_cond_destroy(&walk.cond);
+    free(walk.dirs);
+
+    // Files are parsed in path order, in chunks spread over the threads,
+    // and merged in the same order so that the result doesn't depend on
+    // the thread scheduling
+    qsort(walk.files, walk.file_count, sizeof(source_file_t), compare_files);
+
+    // With a manifest, files that didn't change keep their recorded dependencies
+    // and the ones of deleted files are dropped
+    char *manifest_path = NULL;
+    source_file_t *manifest = NULL;
+    int manifest_count = 0;
+    arena_t manifest_names = {0};
+    uint64_t manifest_macros = 0;
+    parse_jobs_t jobs = { .files = walk.files, .file_count = walk.file_count };
+    if (config.incremental) {
+        manifest_path = get_manifest_path(path);
+        if (manifest_path)
+            manifest = load_manifest(manifest_path, &manifest_count, &manifest_names,
+                                     &manifest_macros);
+        if (manifest)
+            jobs.previous = match_manifest(walk.files, walk.file_count, manifest, manifest_count);
+    }
+
+    int chunk_count = threads * PARSE_CHUNKS_PER_THREAD;
+    jobs.chunk_size = (walk.file_count + chunk_count - 1) / chunk_count;
+    if (jobs.chunk_size < 1) jobs.chunk_size = 1;
+    chunk_count = (walk.file_count + jobs.chunk_size - 1) / jobs.chunk_size;
+    jobs.scratch = calloc(chunk_count + 1, sizeof(dependency_list_t*));
+    if (!jobs.scratch) chunk_count = 0;
+
+    // Build files go first, their -D flags apply to the C files
+    long long start = stats_begin();
+    pool_run(chunk_count, threads, parse_worker, &jobs);
+
+    for (int i = 0; i < walk.file_count; i++) {
+        source_file_t *file = &walk.files[i];
+        for (int j = 0; j < file->dep_count; j++) {
+            if (file->deps[j].type == DEP_TYPE_DEFINE)
+                preproc_define(file->deps[j].name, 0);
+        }
+    }
+
+    // The conditional blocks of C files recorded with other macros may have
+    // another status now
+    uint64_t macros = preproc_hash();
+    if (jobs.previous && manifest_macros != macros) {
+        if (config.debug)
+            printf("ddn:parse_dependencies(): macros changed, parsing all C files\n");
+        for (int i = 0; i < walk.file_count; i++) {
+            if (walk.files[i].kind == SOURCE_C) jobs.previous[i] = NULL;
+        }
+    }
+
+    jobs.c_files = 1;
+    pool_run(chunk_count, threads, parse_worker, &jobs);
+    stats_end(SPAN_PARSE, start, NULL);
+
+    int parsed = 0;
+    for (int i = 0; i < walk.file_count; i++) {
+        source_file_t *file = &walk.files[i];
+        parsed += file->parsed;
+        for (int j = 0; j < file->dep_count; j++) {
+            dependency_t *dep = &file->deps[j];
+            if (dep->type != DEP_TYPE_DEFINE)
+                add_dependency_status(list, dep->name, dep->type, dep->status);
+        }
+    }
+
+    if (config.debug)
+        printf("ddn:parse_dependencies(): %d files, %d parsed\n", walk.file_count, parsed);
+
+    stats_add(STAT_FILES_SCANNED, walk.file_count);
+    stats_add(STAT_FILES_PARSED, parsed);
+    stats_add(STAT_UNIQUE_DEPS, list->count);
+
+    if (manifest_path && save_manifest(manifest_path, walk.files, walk.file_count, macros) != 0)
+        fprintf(stderr, "Warning: cannot write manifest '%s': %s\n", manifest_path, strerror(errno));
+
+    free(manifest_path);
+    free(jobs.previous);
+    free_source_files(manifest, manifest_count);
+    free_source_files(walk.files, walk.file_count);
+    arena_free(&manifest_names);
+    for (int i = 0; i < chunk_count; i++) {
+        free_dependency_list(jobs.scratch[i]);
+    }
+    free(jobs.scratch);
 
     return list;
 }
@@ -1,28 +1,67 @@
 #ifndef PARSER_H
 #define PARSER_H 1
 
+#include "arena.h"
+
 typedef enum {
     DEP_TYPE_HEADER,    // From #include
-    DEP_TYPE_LIBRARY    // From -l flag
+    DEP_TYPE_LIBRARY,   // From -l flag
+    DEP_TYPE_PKGCONFIG, // pkg-config module, from build files
+    DEP_TYPE_DEFINE     // -D flag of build files, applied to the C files
 } dependency_type_t;
 
+// Whether the target compiles the code a dependency was found in,
+// from the strongest to the weakest
+typedef enum {
+    DEP_REQUIRED,       // Always
+    DEP_OPTIONAL,       // Depending on macros we don't know
+    DEP_EXCLUDED        // Never, like #ifdef _WIN32 blocks
+} dependency_status_t;
+
 typedef struct {
     char *name;
     dependency_type_t type;
+    dependency_status_t status;
 } dependency_t;
 
 typedef struct {
     dependency_t *items;
     int count;
     int capacity;
+    int *buckets;       // Open-addressing index of items, -1 when empty
+    int bucket_count;   // Power of two, at least twice the item count
+    arena_t names;      // Item names, each one stored once
 } dependency_list_t;
 
 // Parse dependencies from source directory
 dependency_list_t* parse_dependencies(const char *path);
 
-// Add a dependency to the list
+// Create an empty dependency list
+dependency_list_t* create_dependency_list(void);
+
+// Add a dependency to the list, the list keeps its own copy of the name
 void add_dependency(dependency_list_t *list, const char *name, dependency_type_t type);
 
+// Add a dependency found with a given status, a dependency already in the
+// list keeps the strongest status it was found with
+void add_dependency_status(dependency_list_t *list, const char *name, dependency_type_t type,
+                           dependency_status_t status);
+
+// Create a list with the dependencies whose status is 'weakest' or stronger
+dependency_list_t* select_dependencies(dependency_list_t *list, dependency_status_t weakest);
+
+// Get the index of a dependency in the list, or -1 if it's not there
+int find_dependency(dependency_list_t *list, const char *name, dependency_type_t type);
+
+// Get the letter standing for a dependency type in our files
+char dependency_type_char(dependency_type_t type);
+
+// Get a dependency type from its letter, returns 0 on success
+int dependency_type_from_char(char c, dependency_type_t *type);
+
+// Get the name of a dependency status, for output
+const char* dependency_status_name(dependency_status_t status);
+
 // Free dependency list
 void free_dependency_list(dependency_list_t *list);
 
@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "paths.h"
+
+char* get_xdg_dir(const char *xdg_var, const char *home_fallback) {
+    char *dir = NULL;
+    const char *xdg = getenv(xdg_var);
+    const char *home = getenv("HOME");
+
+    if (xdg && *xdg) {
+        if (asprintf(&dir, "%s/distro-dep-name", xdg) < 0) return NULL;
+    } else if (home && *home) {
+        if (asprintf(&dir, "%s/%s/distro-dep-name", home, home_fallback) < 0) return NULL;
+    }
+
+    return dir;
+}
+
+int make_dirs(const char *path) {
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(tmp, 0755) != 0 && errno != EEXIST) return -1;
+            *p = '/';
+        }
+    }
+    if (mkdir(tmp, 0755) != 0 && errno != EEXIST) return -1;
+
+    return 0;
+}
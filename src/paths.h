@@ -0,0 +1,12 @@
+#ifndef PATHS_H
+#define PATHS_H 1
+
+// Get a directory of ours under an XDG base directory: $<xdg_var>/distro-dep-name,
+// or $HOME/<home_fallback>/distro-dep-name if the variable isn't set.
+// Returns NULL if neither are set, the result must be freed.
+char* get_xdg_dir(const char *xdg_var, const char *home_fallback);
+
+// Create a directory and its parents, returns 0 on success
+int make_dirs(const char *path);
+
+#endif // PATHS_H
@@ -0,0 +1,584 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ddn_config.h"
+#include "pkgindex.h"
+#include "paths.h"
+
+#define INITIAL_CAPACITY 1024
+#define MAX_KEY_LEN 1024
+#define INDEX_MAGIC "DDNINDEX"
+#define INDEX_VERSION 2
+#define INDEX_BLOCK_SIZE 16
+
+// Index file layout, every section starts on an 8-byte boundary:
+//   header
+//   block offsets      uint32 per block, offset of its first entry in the entries
+//   package offsets    uint32 per package id, offset of its name in the pool
+//   pool               NUL-terminated package names, deduplicated and sorted
+//   entries            sorted keys, each as varint shared prefix length,
+//                      varint suffix length, suffix, varint package id
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t package_count;
+    uint32_t block_count;
+    uint32_t block_size;
+    uint32_t reserved;
+    uint64_t blocks_offset;
+    uint64_t packages_offset;
+    uint64_t pool_offset;
+    uint64_t pool_size;
+    uint64_t entries_offset;
+    uint64_t entries_size;
+    uint64_t file_size;
+} index_header_t;
+
+index_builder_t* index_builder_create(void) {
+    index_builder_t *builder = calloc(1, sizeof(index_builder_t));
+    if (!builder) return NULL;
+
+    builder->keys = malloc(INITIAL_CAPACITY * sizeof(char*));
+    builder->packages = malloc(INITIAL_CAPACITY * sizeof(char*));
+    if (!builder->keys || !builder->packages) {
+        free(builder->keys);
+        free(builder->packages);
+        free(builder);
+        return NULL;
+    }
+
+    builder->capacity = INITIAL_CAPACITY;
+    return builder;
+}
+
+static void index_builder_add(index_builder_t *builder, const char *key, const char *package) {
+    if (builder->count >= builder->capacity) {
+        int capacity = builder->capacity * 2;
+        char **keys = realloc(builder->keys, capacity * sizeof(char*));
+        if (!keys) return;
+        builder->keys = keys;
+        char **packages = realloc(builder->packages, capacity * sizeof(char*));
+        if (!packages) return;
+        builder->packages = packages;
+        builder->capacity = capacity;
+    }
+
+    builder->keys[builder->count] = strdup(key);
+    builder->packages[builder->count] = strdup(package);
+    builder->count++;
+}
+
+// Get the library name out of "lib<name>.so", "lib<name>.so.<version>" or "lib<name>.a",
+// versioned sonames are only accepted if 'versioned' is set
+static int library_name(const char *filename, int versioned, char *name, size_t size) {
+    if (strncmp(filename, "lib", 3) != 0) return -1;
+    filename += 3;
+
+    const char *end = strstr(filename, ".so");
+    if (end && (end[3] == '\0' || (versioned && end[3] == '.'))) {
+        // ok
+    } else {
+        size_t len = strlen(filename);
+        if (len < 3 || strcmp(filename + len - 2, ".a") != 0) return -1;
+        end = filename + len - 2;
+    }
+
+    size_t len = end - filename;
+    if (len == 0 || len >= size) return -1;
+    memcpy(name, filename, len);
+    name[len] = '\0';
+
+    return 0;
+}
+
+void index_builder_add_file(index_builder_t *builder, const char *package, const char *path) {
+    if (!builder || !package || !path) return;
+
+    while (*path == '/') path++;
+
+    char key[MAX_KEY_LEN];
+    if (strncmp(path, "usr/include/", 12) == 0) {
+        const char *header = path + 12;
+
+        // Multiarch directories (usr/include/x86_64-linux-gnu/...) are in the search path too
+        const char *slash = strchr(header, '/');
+        if (slash && memmem(header, slash - header, "-linux-", 7))
+            header = slash + 1;
+
+        if (header[0] == '\0' || header[strlen(header) - 1] == '/') return;
+        snprintf(key, sizeof(key), "h:%s", header);
+        index_builder_add(builder, key, package);
+        return;
+    }
+
+    const char *filename = strrchr(path, '/');
+    filename = filename ? filename + 1 : path;
+
+    // pkg-config modules, ".../pkgconfig/<module>.pc" under lib or share
+    size_t len = strlen(filename);
+    if (len > 3 && strcmp(filename + len - 3, ".pc") == 0) {
+        if (filename - path > 10 && memcmp(filename - 11, "/pkgconfig/", 11) == 0) {
+            snprintf(key, sizeof(key), "p:%.*s", (int)(len - 3), filename);
+            index_builder_add(builder, key, package);
+        }
+        return;
+    }
+
+    // Libraries, only in lib directories
+    if (strncmp(path, "usr/lib", 7) != 0 && strncmp(path, "lib", 3) != 0) return;
+
+    char name[MAX_KEY_LEN - 2];
+    if (library_name(filename, 0, name, sizeof(name)) == 0) {
+        snprintf(key, sizeof(key), "l:%s", name);
+        index_builder_add(builder, key, package);
+    }
+}
+
+void index_builder_add_soname(index_builder_t *builder, const char *package, const char *soname) {
+    if (!builder || !package || !soname) return;
+
+    char key[MAX_KEY_LEN];
+    char name[MAX_KEY_LEN - 2];
+    if (library_name(soname, 1, name, sizeof(name)) == 0) {
+        snprintf(key, sizeof(key), "l:%s", name);
+        index_builder_add(builder, key, package);
+    }
+}
+
+void index_builder_add_pkgconfig(index_builder_t *builder, const char *package, const char *module) {
+    if (!builder || !package || !module || !*module) return;
+
+    char key[MAX_KEY_LEN];
+    snprintf(key, sizeof(key), "p:%s", module);
+    index_builder_add(builder, key, package);
+}
+
+// Builder entries are sorted through an array of indexes
+static int compare_entries(const void *a, const void *b, void *arg) {
+    index_builder_t *builder = arg;
+    int ia = *(const int*)a;
+    int ib = *(const int*)b;
+
+    int ret = strcmp(builder->keys[ia], builder->keys[ib]);
+    if (ret == 0)
+        ret = strcmp(builder->packages[ia], builder->packages[ib]);
+    return ret;
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Growable byte buffer for the encoded entries
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t capacity;
+} byte_buffer_t;
+
+static int buffer_reserve(byte_buffer_t *buffer, size_t len) {
+    if (buffer->len + len <= buffer->capacity) return 0;
+
+    size_t capacity = buffer->capacity ? buffer->capacity : 65536;
+    while (buffer->len + len > capacity) capacity *= 2;
+
+    unsigned char *data = realloc(buffer->data, capacity);
+    if (!data) return -1;
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+static int buffer_put_varint(byte_buffer_t *buffer, uint32_t value) {
+    if (buffer_reserve(buffer, 5) != 0) return -1;
+
+    while (value >= 0x80) {
+        buffer->data[buffer->len++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    buffer->data[buffer->len++] = (unsigned char)value;
+    return 0;
+}
+
+static int buffer_put(byte_buffer_t *buffer, const void *data, size_t len) {
+    if (buffer_reserve(buffer, len) != 0) return -1;
+
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+    return 0;
+}
+
+// Write a section at the next 8-byte boundary, returns its offset or 0 on error
+static uint64_t write_section(FILE *f, const void *data, size_t len) {
+    static const char padding[8] = {0};
+
+    long pos = ftell(f);
+    if (pos < 0) return 0;
+    if (pos % 8 && fwrite(padding, 1, 8 - pos % 8, f) != (size_t)(8 - pos % 8)) return 0;
+
+    pos = ftell(f);
+    if (len && fwrite(data, 1, len, f) != len) return 0;
+    return (uint64_t)pos;
+}
+
+// Encode the sorted, unique entries and write the index file
+static int write_index(FILE *f, index_builder_t *builder, const int *entries, uint32_t count) {
+    int ret = -1;
+    byte_buffer_t encoded = {0};
+    byte_buffer_t pool = {0};
+    uint32_t block_count = (count + INDEX_BLOCK_SIZE - 1) / INDEX_BLOCK_SIZE;
+    uint32_t *blocks = malloc((block_count + 1) * sizeof(uint32_t));
+    char **names = malloc((count + 1) * sizeof(char*));
+    uint32_t *package_offsets = malloc((count + 1) * sizeof(uint32_t));
+    if (!blocks || !names || !package_offsets) goto out;
+
+    // Deduplicated package names, sorted so that ids can be found by bsearch()
+    for (uint32_t i = 0; i < count; i++) {
+        names[i] = builder->packages[entries[i]];
+    }
+    qsort(names, count, sizeof(char*), compare_strings);
+    uint32_t package_count = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (package_count > 0 && strcmp(names[package_count - 1], names[i]) == 0) continue;
+        names[package_count] = names[i];
+        package_offsets[package_count] = (uint32_t)pool.len;
+        if (buffer_put(&pool, names[i], strlen(names[i]) + 1) != 0) goto out;
+        package_count++;
+    }
+
+    // Keys are front-coded against the previous key, except the first key
+    // of every block which is stored whole so that blocks can be bisected
+    const char *prev = "";
+    for (uint32_t i = 0; i < count; i++) {
+        const char *key = builder->keys[entries[i]];
+
+        uint32_t shared = 0;
+        if (i % INDEX_BLOCK_SIZE == 0) {
+            blocks[i / INDEX_BLOCK_SIZE] = (uint32_t)encoded.len;
+        } else {
+            while (key[shared] && key[shared] == prev[shared]) shared++;
+        }
+
+        uint32_t suffix_len = (uint32_t)strlen(key + shared);
+        char **name = bsearch(&builder->packages[entries[i]], names, package_count,
+                              sizeof(char*), compare_strings);
+        if (!name ||
+            buffer_put_varint(&encoded, shared) != 0 ||
+            buffer_put_varint(&encoded, suffix_len) != 0 ||
+            buffer_put(&encoded, key + shared, suffix_len) != 0 ||
+            buffer_put_varint(&encoded, (uint32_t)(name - names)) != 0)
+            goto out;
+
+        prev = key;
+    }
+
+    index_header_t header = {0};
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.entry_count = count;
+    header.package_count = package_count;
+    header.block_count = block_count;
+    header.block_size = INDEX_BLOCK_SIZE;
+
+    // Header first as a placeholder, rewritten once the offsets are known
+    if (fwrite(&header, sizeof(header), 1, f) != 1) goto out;
+    if (!(header.blocks_offset = write_section(f, blocks, block_count * sizeof(uint32_t))) ||
+        !(header.packages_offset = write_section(f, package_offsets, package_count * sizeof(uint32_t))) ||
+        !(header.pool_offset = write_section(f, pool.data, pool.len)) ||
+        !(header.entries_offset = write_section(f, encoded.data, encoded.len)))
+        goto out;
+    header.pool_size = pool.len;
+    header.entries_size = encoded.len;
+    header.file_size = (uint64_t)ftell(f);
+
+    if (fseek(f, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, f) != 1) goto out;
+    ret = 0;
+
+out:
+    free(encoded.data);
+    free(pool.data);
+    free(blocks);
+    free(names);
+    free(package_offsets);
+    return ret;
+}
+
+int index_builder_save(index_builder_t *builder, const char *distro_name) {
+    if (!builder || !distro_name) return -1;
+
+    int *order = malloc((builder->count + 1) * sizeof(int));
+    if (!order) return -1;
+    for (int i = 0; i < builder->count; i++) {
+        order[i] = i;
+    }
+
+    qsort_r(order, builder->count, sizeof(int), compare_entries, builder);
+
+    // Drop duplicate entries
+    uint32_t count = 0;
+    for (int i = 0; i < builder->count; i++) {
+        if (count > 0) {
+            int prev = order[count - 1];
+            if (strcmp(builder->keys[order[i]], builder->keys[prev]) == 0 &&
+                strcmp(builder->packages[order[i]], builder->packages[prev]) == 0)
+                continue;
+        }
+        order[count++] = order[i];
+    }
+
+    char *path = index_path(distro_name);
+    char *dir = path ? strdup(path) : NULL;
+    char *slash = dir ? strrchr(dir, '/') : NULL;
+    if (!slash) {
+        free(dir);
+        free(path);
+        free(order);
+        return -1;
+    }
+    *slash = '\0';
+    if (make_dirs(dir) != 0) {
+        fprintf(stderr, "Error: cannot create directory '%s': %s\n", dir, strerror(errno));
+        free(dir);
+        free(path);
+        free(order);
+        return -1;
+    }
+    free(dir);
+
+    // Write a temporary file first so that running queries never see a partial index,
+    // the ones that have the old index mapped keep their copy
+    char *tmp_path = NULL;
+    if (asprintf(&tmp_path, "%s.%d.tmp", path, (int)getpid()) < 0) {
+        free(path);
+        free(order);
+        return -1;
+    }
+
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        fprintf(stderr, "Error: cannot write '%s': %s\n", tmp_path, strerror(errno));
+        free(tmp_path);
+        free(path);
+        free(order);
+        return -1;
+    }
+
+    int ret = write_index(f, builder, order, count);
+    free(order);
+
+    if (fclose(f) != 0 || ret != 0 || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Error: cannot write '%s': %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        ret = -1;
+    } else {
+        printf("Wrote %u entries to %s\n", count, path);
+    }
+
+    free(tmp_path);
+    free(path);
+    return ret;
+}
+
+void index_builder_free(index_builder_t *builder) {
+    if (!builder) return;
+
+    for (int i = 0; i < builder->count; i++) {
+        free(builder->keys[i]);
+        free(builder->packages[i]);
+    }
+    free(builder->keys);
+    free(builder->packages);
+    free(builder);
+}
+
+char* index_path(const char *distro_name) {
+    char *dir = config.index_dir ? strdup(config.index_dir) : get_xdg_dir("XDG_DATA_HOME", ".local/share");
+    if (!dir) return NULL;
+
+    char *path = NULL;
+    if (asprintf(&path, "%s/%s.idx", dir, distro_name) < 0) path = NULL;
+    free(dir);
+
+    return path;
+}
+
+// Check that a section lies within the mapped file
+static int section_ok(const package_index_t *index, uint64_t offset, uint64_t size) {
+    return offset >= sizeof(index_header_t) && offset <= index->size && size <= index->size - offset;
+}
+
+package_index_t* index_open(const char *distro_name) {
+    char *path = index_path(distro_name);
+    if (!path) return NULL;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        free(path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(index_header_t)) {
+        fprintf(stderr, "Warning: ignoring index '%s' (truncated)\n", path);
+        close(fd);
+        free(path);
+        return NULL;
+    }
+
+    // Read-only shared mapping: only the pages touched by lookups get loaded,
+    // and every process using the index shares them from the page cache
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Warning: cannot map index '%s': %s\n", path, strerror(errno));
+        free(path);
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_RANDOM);
+
+    package_index_t *index = calloc(1, sizeof(package_index_t));
+    if (!index) {
+        munmap(map, st.st_size);
+        free(path);
+        return NULL;
+    }
+    index->map = map;
+    index->size = st.st_size;
+
+    const index_header_t *header = map;
+    if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != INDEX_VERSION || header->file_size != index->size ||
+        header->block_size == 0 ||
+        header->block_count != (header->entry_count + header->block_size - 1) / header->block_size ||
+        header->blocks_offset % 4 || header->packages_offset % 4 ||
+        !section_ok(index, header->blocks_offset, (uint64_t)header->block_count * 4) ||
+        !section_ok(index, header->packages_offset, (uint64_t)header->package_count * 4) ||
+        !section_ok(index, header->pool_offset, header->pool_size) ||
+        !section_ok(index, header->entries_offset, header->entries_size) ||
+        (header->pool_size > 0 && ((const char*)map)[header->pool_offset + header->pool_size - 1] != '\0')) {
+        fprintf(stderr, "Warning: ignoring index '%s' (unsupported version or corrupt, "
+                "run 'index build' again)\n", path);
+        free(path);
+        index_close(index);
+        return NULL;
+    }
+
+    index->entry_count = header->entry_count;
+    index->package_count = header->package_count;
+    index->block_count = header->block_count;
+    index->block_size = header->block_size;
+    index->blocks = (const uint32_t*)((const char*)map + header->blocks_offset);
+    index->package_offsets = (const uint32_t*)((const char*)map + header->packages_offset);
+    index->pool = (const char*)map + header->pool_offset;
+    index->pool_size = header->pool_size;
+    index->entries = (const unsigned char*)map + header->entries_offset;
+    index->entries_size = header->entries_size;
+
+    if (config.debug)
+        printf("ddn:index_open(): mapped %u entries from '%s'\n", index->entry_count, path);
+
+    free(path);
+    return index;
+}
+
+// Decode a varint at *pos, returns -1 if it runs past the entries
+static int read_varint(const package_index_t *index, size_t *pos, uint32_t *value) {
+    uint32_t result = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (*pos >= index->entries_size) return -1;
+        unsigned char byte = index->entries[(*pos)++];
+        result |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Decode the entry at *pos on top of the previous key,
+// returns the package id or -1 if the data is corrupt
+static int64_t read_entry(const package_index_t *index, size_t *pos, char *key, size_t *key_len) {
+    uint32_t shared, suffix_len, package_id;
+    if (read_varint(index, pos, &shared) != 0 || shared > *key_len ||
+        read_varint(index, pos, &suffix_len) != 0 || shared + (size_t)suffix_len >= MAX_KEY_LEN ||
+        suffix_len > index->entries_size - *pos)
+        return -1;
+
+    memcpy(key + shared, index->entries + *pos, suffix_len);
+    *pos += suffix_len;
+    *key_len = shared + suffix_len;
+    key[*key_len] = '\0';
+
+    if (read_varint(index, pos, &package_id) != 0 || package_id >= index->package_count)
+        return -1;
+    return package_id;
+}
+
+// Compare a key with the first key of a block, which is stored whole
+static int compare_block(const package_index_t *index, uint32_t block, const char *key, size_t key_len) {
+    size_t pos = index->blocks[block];
+    uint32_t shared, len;
+    if (pos >= index->entries_size ||
+        read_varint(index, &pos, &shared) != 0 || read_varint(index, &pos, &len) != 0 ||
+        len > index->entries_size - pos)
+        return -1;
+
+    size_t n = len < key_len ? len : key_len;
+    int ret = memcmp(index->entries + pos, key, n);
+    if (ret == 0) ret = (len > key_len) - (len < key_len);
+    return ret;
+}
+
+int index_lookup(package_index_t *index, const dependency_t *dep, const char **packages, int max) {
+    if (!index || !dep || max <= 0 || index->entry_count == 0) return 0;
+
+    char key[MAX_KEY_LEN];
+    int len = snprintf(key, sizeof(key), "%c:%s", dependency_type_char(dep->type), dep->name);
+    if (len < 0 || len >= MAX_KEY_LEN) return 0;
+
+    // First block starting at or past the key, matches can start in the block before
+    uint32_t low = 0;
+    uint32_t high = index->block_count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (compare_block(index, mid, key, len) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    uint32_t block = low > 0 ? low - 1 : 0;
+
+    char current[MAX_KEY_LEN];
+    size_t current_len = 0;
+    size_t pos = index->blocks[block];
+    int found = 0;
+    for (uint32_t i = block * index->block_size; i < index->entry_count && found < max; i++) {
+        int64_t package_id = read_entry(index, &pos, current, &current_len);
+        if (package_id < 0) break;
+
+        int cmp = strcmp(current, key);
+        if (cmp > 0) break;
+        if (cmp < 0) continue;
+
+        uint32_t offset = index->package_offsets[package_id];
+        if (offset < index->pool_size)
+            packages[found++] = index->pool + offset;
+    }
+
+    return found;
+}
+
+void index_close(package_index_t *index) {
+    if (!index) return;
+
+    munmap(index->map, index->size);
+    free(index);
+}
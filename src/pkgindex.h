@@ -0,0 +1,69 @@
+#ifndef PKGINDEX_H
+#define PKGINDEX_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parser.h"
+
+// Local file->package index of a distro, built once with 'index build'
+// so that dependencies can be resolved without a VM.
+// Keys are "h:<header path under /usr/include>", "l:<library name>"
+// and "p:<pkg-config module>".
+
+// Entries collected while building an index
+typedef struct {
+    char **keys;
+    char **packages;
+    int count;
+    int capacity;
+} index_builder_t;
+
+// Create an empty index builder
+index_builder_t* index_builder_create(void);
+
+// Record that a package owns a file, only headers, libraries and .pc files are kept
+void index_builder_add_file(index_builder_t *builder, const char *package, const char *path);
+
+// Record a library that a package provides by soname (e.g. "libz.so.1")
+void index_builder_add_soname(index_builder_t *builder, const char *package, const char *soname);
+
+// Record a pkg-config module that a package provides (e.g. "zlib")
+void index_builder_add_pkgconfig(index_builder_t *builder, const char *package, const char *module);
+
+// Sort the entries and write the index file of a distro, returns 0 on success
+int index_builder_save(index_builder_t *builder, const char *distro_name);
+
+// Free an index builder
+void index_builder_free(index_builder_t *builder);
+
+// Index file mapped in memory, lookups read it in place
+typedef struct {
+    void *map;
+    size_t size;
+    uint32_t entry_count;
+    uint32_t package_count;
+    uint32_t block_count;
+    uint32_t block_size;
+    const uint32_t *blocks;
+    const uint32_t *package_offsets;
+    const char *pool;
+    size_t pool_size;
+    const unsigned char *entries;
+    size_t entries_size;
+} package_index_t;
+
+// Get the path of a distro's index file, the result must be freed
+char* index_path(const char *distro_name);
+
+// Map the index of a distro, returns NULL if there's none
+package_index_t* index_open(const char *distro_name);
+
+// Find the packages owning a dependency, fills up to 'max' package names
+// (valid until the index is closed) and returns how many were found
+int index_lookup(package_index_t *index, const dependency_t *dep, const char **packages, int max);
+
+// Unmap an index
+void index_close(package_index_t *index);
+
+#endif // PKGINDEX_H
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "ddn_config.h"
+#include "pool.h"
+
+typedef struct {
+    pool_fn_t fn;
+    void *arg;
+    int count;
+    atomic_int next;
+} pool_t;
+
+// Each worker keeps taking the next index until there's none left
+static void* pool_worker(void *data) {
+    pool_t *pool = data;
+
+    int index;
+    while ((index = atomic_fetch_add(&pool->next, 1)) < pool->count) {
+        pool->fn(index, pool->arg);
+    }
+
+    return NULL;
+}
+
+void pool_run(int count, int jobs, pool_fn_t fn, void *arg) {
+    if (count <= 0 || !fn) return;
+
+    if (jobs > count) jobs = count;
+    if (jobs <= 1) {
+        for (int i = 0; i < count; i++) {
+            fn(i, arg);
+        }
+        return;
+    }
+
+    pool_t pool = { .fn = fn, .arg = arg, .count = count };
+    atomic_init(&pool.next, 0);
+
+    pthread_t *threads = malloc(jobs * sizeof(pthread_t));
+    if (!threads) {
+        pool_worker(&pool);
+        return;
+    }
+
+    // The calling thread works too, so only start jobs - 1 extra threads
+    int started = 0;
+    for (int i = 0; i < jobs - 1; i++) {
+        if (pthread_create(&threads[started], NULL, pool_worker, &pool) != 0) {
+            if (config.debug)
+                printf("ddn:pool_run(): pthread_create() failed\n");
+            break;
+        }
+        started++;
+    }
+
+    pool_worker(&pool);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
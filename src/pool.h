@@ -0,0 +1,11 @@
+#ifndef POOL_H
+#define POOL_H 1
+
+// Work function, called once for each index
+typedef void (*pool_fn_t)(int index, void *arg);
+
+// Run fn(index, arg) for every index in [0, count) on up to 'jobs' threads,
+// returns once all of them are done
+void pool_run(int count, int jobs, pool_fn_t fn, void *arg);
+
+#endif // POOL_H
@@ -0,0 +1,700 @@
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ddn_config.h"
+#include "preproc.h"
+#include "arena.h"
+#include "hash.h"
+
+#define INITIAL_MACROS 64
+#define INITIAL_DEPTH 16
+#define MAX_EXPRESSION 4096
+
+// Three-valued results of conditions
+typedef enum {
+    COND_FALSE,
+    COND_TRUE,
+    COND_UNKNOWN
+} cond_t;
+
+typedef enum {
+    MACRO_UNKNOWN,      // Not in the table
+    MACRO_DEFINED,
+    MACRO_UNDEFINED
+} macro_state_t;
+
+typedef struct {
+    char *name;
+    macro_state_t state;
+    int has_value;      // Defined to an integer
+    long long value;
+    int fixed;          // Set on the command line
+} macro_t;
+
+// Open-addressing table of macros, NULL names are empty slots
+typedef struct {
+    macro_t *slots;
+    int slot_count;     // Power of two, at least twice the macro count
+    int count;
+    arena_t names;
+} macro_table_t;
+
+// One #if ... #endif block
+typedef struct {
+    cond_t branch;      // Whether the current branch is compiled
+    cond_t taken;       // Whether one of the branches so far was compiled
+} frame_t;
+
+struct preproc_state {
+    macro_table_t local;    // #define and #undef of the file so far
+    frame_t *frames;
+    int depth;
+    int capacity;
+    int directives;         // Directives seen in the file
+    const char *guard;      // Macro of the first #ifndef, if it may be an include guard
+    size_t guard_len;
+};
+
+// Defined on every Linux target
+static const char *linux_defined[] = {
+    "__linux__=1", "__linux=1", "linux=1", "__gnu_linux__=1", "__unix__=1", "__unix=1",
+    "unix=1", "__ELF__=1", "__STDC__=1", "__STDC_HOSTED__=1", "__CHAR_BIT__=8",
+    // Compiler and standard versions vary, only their presence is known
+    "__GNUC__", "__GNUC_MINOR__", "__STDC_VERSION__", NULL
+};
+
+// Other platforms and compilers
+static const char *linux_undefined[] = {
+    "_WIN32", "_WIN64", "WIN32", "WIN64", "_WINDOWS", "__WIN32__", "__WINDOWS__",
+    "__CYGWIN__", "__MINGW32__", "__MINGW64__", "_MSC_VER", "__BORLANDC__",
+    "__APPLE__", "__MACH__", "__FreeBSD__", "__NetBSD__", "__OpenBSD__", "__DragonFly__",
+    "__sun", "__SVR4", "_AIX", "__hpux", "__HAIKU__", "__BEOS__", "__ANDROID__",
+    "__EMSCRIPTEN__", "__OS2__", "__QNX__", "__vxworks", "__MSDOS__", "__DJGPP__", NULL
+};
+
+static macro_table_t global_macros;
+
+static int is_ident_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static int is_ident_char(char c) {
+    return is_ident_start(c) || (c >= '0' && c <= '9');
+}
+
+static const char* skip_blanks(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+static const char* skip_ident(const char *p, const char *end) {
+    while (p < end && is_ident_char(*p)) p++;
+    return p;
+}
+
+// Get the slot holding a macro, or the empty slot where it would go
+static macro_t* find_slot(macro_table_t *table, const char *name, size_t len) {
+    int mask = table->slot_count - 1;
+    int slot = hash_bytes(HASH_INIT, name, len) & mask;
+
+    while (table->slots[slot].name) {
+        macro_t *macro = &table->slots[slot];
+        if (strncmp(macro->name, name, len) == 0 && macro->name[len] == '\0') break;
+        slot = (slot + 1) & mask;
+    }
+
+    return &table->slots[slot];
+}
+
+static macro_t* lookup_macro(const macro_table_t *table, const char *name, size_t len) {
+    if (!table->count) return NULL;
+
+    macro_t *macro = find_slot((macro_table_t*)table, name, len);
+    return macro->name ? macro : NULL;
+}
+
+// Get a macro's entry, added if it's not there yet
+static macro_t* get_macro(macro_table_t *table, const char *name, size_t len) {
+    if (table->count * 2 >= table->slot_count) {
+        int slot_count = table->slot_count ? table->slot_count * 2 : INITIAL_MACROS;
+        macro_t *slots = calloc(slot_count, sizeof(macro_t));
+        if (!slots) return NULL;
+
+        macro_table_t grown = { slots, slot_count, table->count, table->names };
+        for (int i = 0; i < table->slot_count; i++) {
+            if (table->slots[i].name) {
+                macro_t *macro = &table->slots[i];
+                *find_slot(&grown, macro->name, strlen(macro->name)) = *macro;
+            }
+        }
+        free(table->slots);
+        *table = grown;
+    }
+
+    macro_t *macro = find_slot(table, name, len);
+    if (!macro->name) {
+        char *copy = arena_strndup(&table->names, name, len);
+        if (!copy) return NULL;
+        memset(macro, 0, sizeof(macro_t));
+        macro->name = copy;
+        table->count++;
+    }
+
+    return macro;
+}
+
+static void clear_macros(macro_table_t *table) {
+    if (table->count == 0) return;
+
+    memset(table->slots, 0, table->slot_count * sizeof(macro_t));
+    table->count = 0;
+    arena_free(&table->names);
+}
+
+static void free_macros(macro_table_t *table) {
+    free(table->slots);
+    arena_free(&table->names);
+    memset(table, 0, sizeof(macro_table_t));
+}
+
+// Parse an integer literal, possibly in parentheses, covering all of [p, end)
+static int parse_integer(const char *p, const char *end, long long *value) {
+    p = skip_blanks(p, end);
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) end--;
+    if (end - p >= 2 && *p == '(' && end[-1] == ')') return parse_integer(p + 1, end - 1, value);
+
+    char buffer[32];
+    size_t len = end - p;
+    if (len == 0 || len >= sizeof(buffer) || *p < '0' || *p > '9') return -1;
+    memcpy(buffer, p, len);
+    buffer[len] = '\0';
+
+    char *rest;
+    *value = (long long)strtoull(buffer, &rest, 0);
+    while (*rest == 'u' || *rest == 'U' || *rest == 'l' || *rest == 'L') rest++;
+
+    return *rest == '\0' ? 0 : -1;
+}
+
+// Set a macro from "NAME", "NAME=VALUE" or the "NAME VALUE" of a #define
+static void define_macro(macro_table_t *table, const char *p, const char *end, int fixed) {
+    p = skip_blanks(p, end);
+    const char *name_end = skip_ident(p, end);
+    if (name_end == p || !is_ident_start(*p)) return;
+
+    macro_t *macro = get_macro(table, p, name_end - p);
+    if (!macro || (macro->fixed && !fixed)) return;
+
+    macro->state = MACRO_DEFINED;
+    macro->fixed = fixed;
+    macro->has_value = 0;
+
+    // Function-like macros have no value of their own
+    if (name_end < end && *name_end == '(') return;
+    if (name_end < end && *name_end == '=') name_end++;
+    macro->has_value = parse_integer(name_end, end, &macro->value) == 0;
+}
+
+void preproc_init(void) {
+    for (int i = 0; linux_defined[i]; i++) {
+        const char *definition = linux_defined[i];
+        define_macro(&global_macros, definition, definition + strlen(definition), 0);
+    }
+
+    for (int i = 0; linux_undefined[i]; i++) {
+        preproc_undefine(linux_undefined[i], 0);
+    }
+}
+
+void preproc_define(const char *definition, int fixed) {
+    if (config.debug)
+        printf("ddn:preproc_define(): '%s'%s\n", definition, fixed ? " (fixed)" : "");
+
+    define_macro(&global_macros, definition, definition + strlen(definition), fixed);
+}
+
+void preproc_undefine(const char *name, int fixed) {
+    macro_t *macro = get_macro(&global_macros, name, strlen(name));
+    if (!macro || (macro->fixed && !fixed)) return;
+
+    macro->state = MACRO_UNDEFINED;
+    macro->has_value = 0;
+    macro->fixed = fixed;
+}
+
+uint64_t preproc_hash(void) {
+    // The slot order depends on the insertion order, so the hashes
+    // of the macros are summed up
+    uint64_t sum = 0;
+    for (int i = 0; i < global_macros.slot_count; i++) {
+        macro_t *macro = &global_macros.slots[i];
+        if (!macro->name) continue;
+
+        uint64_t hash = hash_bytes64(HASH64_INIT, macro->name, strlen(macro->name));
+        hash = hash_bytes64(hash, &macro->state, sizeof(macro->state));
+        if (macro->has_value) hash = hash_bytes64(hash, &macro->value, sizeof(macro->value));
+        sum += hash;
+    }
+
+    return sum;
+}
+
+void preproc_free(void) {
+    free_macros(&global_macros);
+}
+
+preproc_state_t* preproc_state_create(void) {
+    preproc_state_t *state = calloc(1, sizeof(preproc_state_t));
+    if (!state) return NULL;
+
+    state->frames = malloc(INITIAL_DEPTH * sizeof(frame_t));
+    if (!state->frames) {
+        free(state);
+        return NULL;
+    }
+    state->capacity = INITIAL_DEPTH;
+
+    return state;
+}
+
+void preproc_state_reset(preproc_state_t *state) {
+    clear_macros(&state->local);
+    state->depth = 0;
+    state->directives = 0;
+    state->guard = NULL;
+}
+
+void preproc_state_free(preproc_state_t *state) {
+    if (!state) return;
+
+    free_macros(&state->local);
+    free(state->frames);
+    free(state);
+}
+
+// The file's own #define and #undef come before the global macros
+static macro_state_t get_macro_state(const preproc_state_t *state, const char *name, size_t len,
+                                     const macro_t **found) {
+    const macro_t *macro = lookup_macro(&state->local, name, len);
+    if (!macro) macro = lookup_macro(&global_macros, name, len);
+
+    *found = macro;
+    return macro ? macro->state : MACRO_UNKNOWN;
+}
+
+// Value of an #if expression, unknown when it depends on unknown macros
+typedef struct {
+    long long value;
+    int known;
+} value_t;
+
+typedef struct {
+    const preproc_state_t *state;
+    const char *p;
+    int error;
+} expression_t;
+
+static const value_t unknown_value = { 0, 0 };
+
+static value_t known_value(long long value) {
+    return (value_t){ value, 1 };
+}
+
+static void skip_space(expression_t *e) {
+    while (*e->p == ' ' || *e->p == '\t' || *e->p == '\r' || *e->p == '\n') e->p++;
+}
+
+// Consume an operator if it's next, but not the start of a longer one
+static int accept(expression_t *e, const char *op, const char *not_followed_by) {
+    skip_space(e);
+    size_t len = strlen(op);
+    if (strncmp(e->p, op, len) != 0) return 0;
+    if (not_followed_by && e->p[len] && strchr(not_followed_by, e->p[len])) return 0;
+
+    e->p += len;
+    return 1;
+}
+
+static value_t parse_conditional(expression_t *e);
+
+// Skip the arguments of a function-like macro, up to the matching ')'
+static void skip_arguments(expression_t *e) {
+    int level = 0;
+    for (; *e->p; e->p++) {
+        if (*e->p == '(') level++;
+        else if (*e->p == ')' && --level == 0) {
+            e->p++;
+            return;
+        }
+    }
+    e->error = 1;
+}
+
+static value_t parse_primary(expression_t *e) {
+    skip_space(e);
+    const char *p = e->p;
+
+    if (*p == '(') {
+        e->p++;
+        value_t value = parse_conditional(e);
+        if (!accept(e, ")", NULL)) e->error = 1;
+        return value;
+    }
+
+    if (*p >= '0' && *p <= '9') {
+        char *rest;
+        long long value = (long long)strtoull(p, &rest, 0);
+        while (*rest == 'u' || *rest == 'U' || *rest == 'l' || *rest == 'L') rest++;
+        e->p = rest;
+        return known_value(value);
+    }
+
+    // Character constants, without escapes
+    if (*p == '\'' && p[1] && p[1] != '\\' && p[2] == '\'') {
+        e->p += 3;
+        return known_value((unsigned char)p[1]);
+    }
+
+    if (!is_ident_start(*p)) {
+        e->error = 1;
+        return unknown_value;
+    }
+
+    const char *end = p + strlen(p);
+    const char *name_end = skip_ident(p, end);
+    e->p = name_end;
+
+    const macro_t *macro;
+    if (name_end - p == 7 && memcmp(p, "defined", 7) == 0) {
+        int parens = accept(e, "(", NULL);
+        skip_space(e);
+        const char *name = e->p;
+        e->p = skip_ident(e->p, end);
+        size_t len = e->p - name;
+        if (len == 0 || (parens && !accept(e, ")", NULL))) {
+            e->error = 1;
+            return unknown_value;
+        }
+
+        macro_state_t state = get_macro_state(e->state, name, len, &macro);
+        return state == MACRO_UNKNOWN ? unknown_value : known_value(state == MACRO_DEFINED);
+    }
+
+    // Calls like __has_include(...) or GCC_VERSION_AT_LEAST(4, 8)
+    skip_space(e);
+    if (*e->p == '(') {
+        skip_arguments(e);
+        return unknown_value;
+    }
+
+    macro_state_t state = get_macro_state(e->state, p, name_end - p, &macro);
+    if (state == MACRO_UNDEFINED) return known_value(0);
+    if (state == MACRO_DEFINED && macro->has_value) return known_value(macro->value);
+    return unknown_value;
+}
+
+static value_t parse_unary(expression_t *e) {
+    if (accept(e, "!", "=")) {
+        value_t value = parse_unary(e);
+        return value.known ? known_value(!value.value) : value;
+    }
+    if (accept(e, "~", NULL)) {
+        value_t value = parse_unary(e);
+        return value.known ? known_value(~value.value) : value;
+    }
+    if (accept(e, "-", NULL)) {
+        value_t value = parse_unary(e);
+        return value.known ? known_value((long long)(0 - (unsigned long long)value.value)) : value;
+    }
+    if (accept(e, "+", NULL)) return parse_unary(e);
+
+    return parse_primary(e);
+}
+
+// Binary operators, from the lowest precedence to the highest
+typedef enum {
+    LEVEL_OR, LEVEL_AND, LEVEL_BIT_OR, LEVEL_BIT_XOR, LEVEL_BIT_AND,
+    LEVEL_EQUALITY, LEVEL_RELATIONAL, LEVEL_SHIFT, LEVEL_ADDITIVE, LEVEL_MULTIPLICATIVE,
+    LEVEL_UNARY
+} level_t;
+
+typedef struct {
+    const char *op;
+    const char *not_followed_by;
+    level_t level;
+} operator_t;
+
+// Longer operators first
+static const operator_t operators[] = {
+    { "||", NULL, LEVEL_OR },
+    { "&&", NULL, LEVEL_AND },
+    { "|", "|", LEVEL_BIT_OR },
+    { "^", NULL, LEVEL_BIT_XOR },
+    { "&", "&", LEVEL_BIT_AND },
+    { "==", NULL, LEVEL_EQUALITY },
+    { "!=", NULL, LEVEL_EQUALITY },
+    { "<=", NULL, LEVEL_RELATIONAL },
+    { ">=", NULL, LEVEL_RELATIONAL },
+    { "<<", NULL, LEVEL_SHIFT },
+    { ">>", NULL, LEVEL_SHIFT },
+    { "<", NULL, LEVEL_RELATIONAL },
+    { ">", NULL, LEVEL_RELATIONAL },
+    { "+", NULL, LEVEL_ADDITIVE },
+    { "-", NULL, LEVEL_ADDITIVE },
+    { "*", NULL, LEVEL_MULTIPLICATIVE },
+    { "/", NULL, LEVEL_MULTIPLICATIVE },
+    { "%", NULL, LEVEL_MULTIPLICATIVE },
+    { NULL, NULL, 0 }
+};
+
+static value_t apply_operator(const char *op, value_t a, value_t b) {
+    // A known false operand decides && and a known true one decides ||
+    if (strcmp(op, "&&") == 0) {
+        if ((a.known && !a.value) || (b.known && !b.value)) return known_value(0);
+        return a.known && b.known ? known_value(1) : unknown_value;
+    }
+    if (strcmp(op, "||") == 0) {
+        if ((a.known && a.value) || (b.known && b.value)) return known_value(1);
+        return a.known && b.known ? known_value(0) : unknown_value;
+    }
+    if (!a.known || !b.known) return unknown_value;
+
+    long long x = a.value, y = b.value;
+    unsigned long long ux = x, uy = y;
+    switch (op[0]) {
+        case '|': return known_value(x | y);
+        case '^': return known_value(x ^ y);
+        case '&': return known_value(x & y);
+        case '=': return known_value(x == y);
+        case '!': return known_value(x != y);
+        case '+': return known_value((long long)(ux + uy));
+        case '-': return known_value((long long)(ux - uy));
+        case '*': return known_value((long long)(ux * uy));
+        case '/':
+        case '%':
+            if (y == 0 || (y == -1 && x == LLONG_MIN)) return unknown_value;
+            return known_value(op[0] == '/' ? x / y : x % y);
+    }
+    if (op[0] == '<' && op[1] == '<') return y >= 0 && y < 64 ? known_value((long long)(ux << y)) : unknown_value;
+    if (op[0] == '>' && op[1] == '>') return y >= 0 && y < 64 ? known_value(x >> y) : unknown_value;
+    if (op[0] == '<') return known_value(op[1] == '=' ? x <= y : x < y);
+    if (op[0] == '>') return known_value(op[1] == '=' ? x >= y : x > y);
+
+    return unknown_value;
+}
+
+static value_t parse_binary(expression_t *e, level_t level) {
+    if (level == LEVEL_UNARY) return parse_unary(e);
+
+    value_t value = parse_binary(e, level + 1);
+    while (!e->error) {
+        const operator_t *found = NULL;
+        for (const operator_t *op = operators; op->op; op++) {
+            if (op->level == level && accept(e, op->op, op->not_followed_by)) {
+                found = op;
+                break;
+            }
+        }
+        if (!found) break;
+
+        value = apply_operator(found->op, value, parse_binary(e, level + 1));
+    }
+
+    return value;
+}
+
+static value_t parse_conditional(expression_t *e) {
+    value_t condition = parse_binary(e, LEVEL_OR);
+    if (!accept(e, "?", NULL)) return condition;
+
+    value_t if_true = parse_conditional(e);
+    if (!accept(e, ":", NULL)) {
+        e->error = 1;
+        return unknown_value;
+    }
+    value_t if_false = parse_conditional(e);
+
+    if (condition.known) return condition.value ? if_true : if_false;
+    if (if_true.known && if_false.known && if_true.value == if_false.value) return if_true;
+    return unknown_value;
+}
+
+// Copy an expression without its comments, continuation lines joined
+static void copy_expression(char *buffer, size_t size, const char *p, const char *end) {
+    size_t len = 0;
+    while (p < end && len + 1 < size) {
+        if (*p == '\\' && p + 1 < end && (p[1] == '\n' || p[1] == '\r')) {
+            p++;
+        } else if (*p == '/' && p + 1 < end && p[1] == '/') {
+            break;
+        } else if (*p == '/' && p + 1 < end && p[1] == '*') {
+            const char *close = p + 2;
+            while (close + 1 < end && !(close[0] == '*' && close[1] == '/')) close++;
+            p = close + 2;
+            buffer[len++] = ' ';
+            continue;
+        } else {
+            buffer[len++] = *p == '\n' || *p == '\r' ? ' ' : *p;
+        }
+        p++;
+    }
+    buffer[len] = '\0';
+}
+
+static cond_t evaluate(const preproc_state_t *state, const char *p, const char *end) {
+    char buffer[MAX_EXPRESSION];
+    copy_expression(buffer, sizeof(buffer), p, end);
+
+    expression_t e = { state, buffer, 0 };
+    value_t value = parse_conditional(&e);
+    skip_space(&e);
+    if (e.error || *e.p) return COND_UNKNOWN;
+
+    return value.known ? (value.value ? COND_TRUE : COND_FALSE) : COND_UNKNOWN;
+}
+
+static cond_t evaluate_defined(const preproc_state_t *state, const char *p, const char *end,
+                               int negate) {
+    p = skip_blanks(p, end);
+    const char *name_end = skip_ident(p, end);
+    const macro_t *macro;
+    macro_state_t macro_state = get_macro_state(state, p, name_end - p, &macro);
+
+    if (name_end == p || macro_state == MACRO_UNKNOWN) return COND_UNKNOWN;
+    return (macro_state == MACRO_DEFINED) != negate ? COND_TRUE : COND_FALSE;
+}
+
+static cond_t cond_not(cond_t cond) {
+    return cond == COND_UNKNOWN ? cond : (cond == COND_TRUE ? COND_FALSE : COND_TRUE);
+}
+
+static cond_t cond_or(cond_t a, cond_t b) {
+    if (a == COND_TRUE || b == COND_TRUE) return COND_TRUE;
+    return a == COND_FALSE && b == COND_FALSE ? COND_FALSE : COND_UNKNOWN;
+}
+
+static cond_t current_cond(const preproc_state_t *state) {
+    cond_t cond = COND_TRUE;
+    for (int i = 0; i < state->depth; i++) {
+        if (state->frames[i].branch == COND_FALSE) return COND_FALSE;
+        if (state->frames[i].branch == COND_UNKNOWN) cond = COND_UNKNOWN;
+    }
+    return cond;
+}
+
+static void push_frame(preproc_state_t *state, cond_t cond) {
+    if (state->depth >= state->capacity) {
+        frame_t *frames = realloc(state->frames, state->capacity * 2 * sizeof(frame_t));
+        if (!frames) return;
+        state->frames = frames;
+        state->capacity *= 2;
+    }
+
+    state->frames[state->depth].branch = cond;
+    state->frames[state->depth].taken = cond;
+    state->depth++;
+}
+
+// Next branch of the innermost block, 'cond' being its own condition
+static void next_branch(preproc_state_t *state, cond_t cond) {
+    if (state->depth == 0) return;
+
+    frame_t *frame = &state->frames[state->depth - 1];
+    if (frame->taken == COND_TRUE) {
+        frame->branch = COND_FALSE;
+    } else if (frame->taken == COND_FALSE) {
+        frame->branch = cond;
+    } else {
+        frame->branch = cond == COND_FALSE ? COND_FALSE : COND_UNKNOWN;
+    }
+    frame->taken = cond_or(frame->taken, cond);
+}
+
+// #define and #undef only count for sure in code that's compiled
+static void set_local_macro(preproc_state_t *state, const char *p, const char *end, int define) {
+    cond_t cond = current_cond(state);
+    if (cond == COND_FALSE) return;
+
+    p = skip_blanks(p, end);
+    const char *name_end = skip_ident(p, end);
+    if (name_end == p) return;
+
+    if (cond == COND_UNKNOWN) {
+        macro_t *macro = get_macro(&state->local, p, name_end - p);
+        if (macro) {
+            macro->state = MACRO_UNKNOWN;
+            macro->has_value = 0;
+        }
+    } else if (define) {
+        char buffer[MAX_EXPRESSION];
+        copy_expression(buffer, sizeof(buffer), p, end);
+        define_macro(&state->local, buffer, buffer + strlen(buffer), 0);
+    } else {
+        macro_t *macro = get_macro(&state->local, p, name_end - p);
+        if (macro) {
+            macro->state = MACRO_UNDEFINED;
+            macro->has_value = 0;
+        }
+    }
+}
+
+void preproc_directive(preproc_state_t *state, const char *p, const char *end) {
+    p = skip_blanks(p, end);
+    const char *keyword = p;
+    p = skip_ident(p, end);
+    size_t len = p - keyword;
+
+    // An #ifndef at the top directly followed by the #define of the
+    // same macro is an include guard, its block is always compiled
+    const char *guard = state->guard;
+    size_t guard_len = state->guard_len;
+    state->guard = NULL;
+    int first = state->directives++ == 0;
+
+    if (len == 2 && memcmp(keyword, "if", 2) == 0) {
+        push_frame(state, evaluate(state, p, end));
+    } else if (len == 5 && memcmp(keyword, "ifdef", 5) == 0) {
+        push_frame(state, evaluate_defined(state, p, end, 0));
+    } else if (len == 6 && memcmp(keyword, "ifndef", 6) == 0) {
+        cond_t cond = evaluate_defined(state, p, end, 1);
+        push_frame(state, cond);
+        if (first && cond == COND_UNKNOWN) {
+            state->guard = skip_blanks(p, end);
+            state->guard_len = skip_ident(state->guard, end) - state->guard;
+        }
+    } else if (len == 4 && memcmp(keyword, "elif", 4) == 0) {
+        // Not evaluated at all after a branch that's compiled for sure
+        int decided = state->depth > 0 && state->frames[state->depth - 1].taken == COND_TRUE;
+        next_branch(state, decided ? COND_FALSE : evaluate(state, p, end));
+    } else if (len == 7 && memcmp(keyword, "elifdef", 7) == 0) {
+        next_branch(state, evaluate_defined(state, p, end, 0));
+    } else if (len == 8 && memcmp(keyword, "elifndef", 8) == 0) {
+        next_branch(state, evaluate_defined(state, p, end, 1));
+    } else if (len == 4 && memcmp(keyword, "else", 4) == 0) {
+        if (state->depth > 0) next_branch(state, cond_not(state->frames[state->depth - 1].taken));
+    } else if (len == 5 && memcmp(keyword, "endif", 5) == 0) {
+        if (state->depth > 0) state->depth--;
+    } else if (len == 6 && memcmp(keyword, "define", 6) == 0) {
+        const char *name = skip_blanks(p, end);
+        if (guard && state->depth == 1 && skip_ident(name, end) - name == (ptrdiff_t)guard_len &&
+            memcmp(name, guard, guard_len) == 0) {
+            state->frames[0].branch = COND_TRUE;
+            state->frames[0].taken = COND_TRUE;
+        }
+        set_local_macro(state, p, end, 1);
+    } else if (len == 5 && memcmp(keyword, "undef", 5) == 0) {
+        set_local_macro(state, p, end, 0);
+    }
+}
+
+dependency_status_t preproc_status(const preproc_state_t *state) {
+    switch (current_cond(state)) {
+        case COND_TRUE: return DEP_REQUIRED;
+        case COND_FALSE: return DEP_EXCLUDED;
+        case COND_UNKNOWN: return DEP_OPTIONAL;
+    }
+    return DEP_OPTIONAL;
+}
@@ -0,0 +1,45 @@
+#ifndef PREPROC_H
+#define PREPROC_H 1
+
+#include <stdint.h>
+
+#include "parser.h"
+
+// Conditional blocks of C files: whether the #include directives in them get
+// compiled on the target. Macros are known to be defined (with a value or
+// not), known to be undefined, or unknown, in which case the blocks depending
+// on them may or may not be compiled.
+
+// Set the predefined macros of a Linux target, before anything else
+void preproc_init(void);
+
+// Define a macro for every file from "NAME" or "NAME=VALUE". Macros set
+// with 'fixed' (from the command line) aren't changed by later calls without it.
+void preproc_define(const char *definition, int fixed);
+
+// Make a macro known to be undefined for every file
+void preproc_undefine(const char *name, int fixed);
+
+// Hash of every macro known, files parsed with other macros can get other results
+uint64_t preproc_hash(void);
+
+void preproc_free(void);
+
+// State of the conditional blocks while scanning one file
+typedef struct preproc_state preproc_state_t;
+
+preproc_state_t* preproc_state_create(void);
+
+// Start a new file
+void preproc_state_reset(preproc_state_t *state);
+
+void preproc_state_free(preproc_state_t *state);
+
+// Handle a directive other than #include, 'p' is just after the '#' and
+// 'end' at the end of the line, continuation lines included
+void preproc_directive(preproc_state_t *state, const char *p, const char *end);
+
+// Status of the dependencies found at the current position
+dependency_status_t preproc_status(const preproc_state_t *state);
+
+#endif // PREPROC_H
@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ddn_config.h"
+#include "remote.h"
+#include "stats.h"
+
+#define NS_PER_MS 1000000LL
+#define NS_PER_SEC 1000000000LL
+#define RETRY_BACKOFF_MS 250
+#define OUTPUT_INITIAL_CAPACITY 4096
+#define OUTPUT_MAX_BUFFERED (8 << 20)
+
+// Exit status of hedged attempts whose output outgrew OUTPUT_MAX_BUFFERED
+#define OUTPUT_OVERFLOWED -5
+
+static const char *failure_names[] = {
+    [REMOTE_OK] = "ok",
+    [REMOTE_TIMEOUT] = "timeout",
+    [REMOTE_DEADLINE] = "deadline",
+    [REMOTE_CONNECTION] = "connection",
+    [REMOTE_COMMAND] = "command",
+};
+
+remote_failure_t remote_failure(int status) {
+    switch (status) {
+        case REMOTE_NOT_RUN: return REMOTE_DEADLINE;
+        case BACKEND_TIMED_OUT: return REMOTE_TIMEOUT;
+        case -1:
+        case 125:
+        case 255: return REMOTE_CONNECTION;
+        case 126:
+        case 127: return REMOTE_COMMAND;
+        default: return REMOTE_OK;
+    }
+}
+
+const char* remote_failure_name(remote_failure_t failure) {
+    return failure_names[failure];
+}
+
+remote_failure_t parse_remote_failure(const char *name) {
+    for (size_t i = 0; i < sizeof(failure_names) / sizeof(failure_names[0]); i++) {
+        if (strcmp(name, failure_names[i]) == 0) return i;
+    }
+    return REMOTE_CONNECTION;
+}
+
+// Failures another attempt may not run into: the host or the link had a
+// problem, not the command. Missing package managers stay missing.
+static int is_transient(int status) {
+    remote_failure_t failure = remote_failure(status);
+    return failure == REMOTE_TIMEOUT || failure == REMOTE_CONNECTION;
+}
+
+// Lines of an attempt going straight to the caller
+typedef struct {
+    line_fn_t fn;
+    void *arg;
+    int lines;                  // Lines passed on so far
+} stream_t;
+
+static void stream_line(char *line, void *arg) {
+    stream_t *stream = arg;
+    stream->lines++;
+    stream->fn(line, stream->arg);
+}
+
+// Output lines of a hedged attempt, each one followed by its '\0'. Its
+// command is killed once they take more than OUTPUT_MAX_BUFFERED bytes.
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+    int failed;                 // A line couldn't be kept
+    int overflowed;             // Too many lines to keep
+    atomic_int *cancel;
+} output_buffer_t;
+
+static void buffer_line(char *line, void *arg) {
+    output_buffer_t *output = arg;
+    size_t len = strlen(line) + 1;
+
+    if (output->failed || output->overflowed) return;
+    if (output->len + len > OUTPUT_MAX_BUFFERED) {
+        output->overflowed = 1;
+        atomic_store(output->cancel, 1);
+        return;
+    }
+
+    if (output->len + len > output->capacity) {
+        size_t capacity = output->capacity ? output->capacity : OUTPUT_INITIAL_CAPACITY;
+        while (output->len + len > capacity) capacity *= 2;
+        char *data = realloc(output->data, capacity);
+        if (!data) {
+            output->failed = 1;
+            return;
+        }
+        output->data = data;
+        output->capacity = capacity;
+    }
+
+    memcpy(output->data + output->len, line, len);
+    output->len += len;
+}
+
+static void replay_lines(output_buffer_t *output, line_fn_t fn, void *arg) {
+    char *p = output->data;
+    char *end = output->data + output->len;
+    while (p < end) {
+        size_t len = strlen(p);
+        fn(p, arg);
+        p += len + 1;
+    }
+}
+
+// Hedged attempts signal the end of their command to the caller
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} hedge_t;
+
+// One run of a command on one host
+typedef struct {
+    backend_t *backend;
+    const char *command;
+    long long deadline;
+    output_buffer_t output;
+    char *errors;
+    int status;
+    atomic_int cancel;
+    int started;
+    int finished;
+    pthread_t thread;
+    hedge_t *hedge;
+} attempt_t;
+
+static void run_attempt(attempt_t *attempt) {
+    attempt->status = backend_run_until(attempt->backend, attempt->command, buffer_line,
+                                        &attempt->output, &attempt->errors, attempt->deadline,
+                                        &attempt->cancel);
+    if (attempt->output.overflowed) attempt->status = OUTPUT_OVERFLOWED;
+    else if (attempt->output.failed && attempt->status >= 0) attempt->status = -1;
+    if (attempt->status == BACKEND_TIMED_OUT) stats_add(STAT_TIMEOUTS, 1);
+}
+
+static void* attempt_thread(void *arg) {
+    attempt_t *attempt = arg;
+    run_attempt(attempt);
+
+    pthread_mutex_lock(&attempt->hedge->lock);
+    attempt->finished = 1;
+    pthread_cond_broadcast(&attempt->hedge->cond);
+    pthread_mutex_unlock(&attempt->hedge->lock);
+    return NULL;
+}
+
+static int start_attempt(attempt_t *attempt) {
+    attempt->started = pthread_create(&attempt->thread, NULL, attempt_thread, attempt) == 0;
+    return attempt->started ? 0 : -1;
+}
+
+static struct timespec monotonic_timespec(long long time) {
+    return (struct timespec){ .tv_sec = time / NS_PER_SEC, .tv_nsec = time % NS_PER_SEC };
+}
+
+// Run a command on host 'first' and, when it hasn't answered after
+// --hedge-after, a copy on the next host: the first to succeed wins and the
+// other one is killed. Hosts that answer slowly once in a while don't make
+// the whole run wait for them. Only the winner's output may reach the
+// caller, so both are kept until then.
+static int run_hedged(remote_t *remote, int first, const char *command, long long deadline,
+                      output_buffer_t *output, char **errors) {
+    attempt_t attempts[2] = {
+        { .backend = remote->hosts[first], .command = command, .deadline = deadline },
+        { .backend = remote->hosts[(first + 1) % remote->count], .command = command,
+          .deadline = deadline },
+    };
+    int count = 1;
+    attempts[0].output.cancel = &attempts[0].cancel;
+    attempts[1].output.cancel = &attempts[1].cancel;
+
+    hedge_t hedge;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&hedge.lock, NULL);
+    pthread_cond_init(&hedge.cond, &attr);
+    pthread_condattr_destroy(&attr);
+    attempts[0].hedge = attempts[1].hedge = &hedge;
+
+    pthread_mutex_lock(&hedge.lock);
+    if (start_attempt(&attempts[0]) != 0) {
+        pthread_mutex_unlock(&hedge.lock);
+        run_attempt(&attempts[0]);
+    } else {
+        struct timespec hedge_at = monotonic_timespec(stats_now() + config.hedge_delay * NS_PER_MS);
+        while (!attempts[0].finished &&
+               pthread_cond_timedwait(&hedge.cond, &hedge.lock, &hedge_at) != ETIMEDOUT) {
+        }
+
+        if (!attempts[0].finished) {
+            if (config.debug)
+                printf("ddn:run_hedged(): no answer from host %d after %ldms, hedging on host %d\n",
+                       first, config.hedge_delay, (first + 1) % remote->count);
+            if (start_attempt(&attempts[1]) == 0) {
+                count = 2;
+                stats_add(STAT_HEDGED, 1);
+            }
+        }
+
+        // Wait for a success, or for every attempt to fail
+        while (1) {
+            int running = 0, won = 0;
+            for (int i = 0; i < count; i++) {
+                if (!attempts[i].finished) running++;
+                else if (!is_transient(attempts[i].status)) won = 1;
+            }
+            if (won || !running) break;
+            pthread_cond_wait(&hedge.cond, &hedge.lock);
+        }
+        pthread_mutex_unlock(&hedge.lock);
+
+        for (int i = 0; i < count; i++) {
+            atomic_store(&attempts[i].cancel, 1);
+            pthread_join(attempts[i].thread, NULL);
+        }
+    }
+
+    pthread_cond_destroy(&hedge.cond);
+    pthread_mutex_destroy(&hedge.lock);
+
+    // The first host's result unless the hedged copy succeeded instead
+    int winner = 0;
+    if (count == 2 && (is_transient(attempts[0].status) || attempts[0].status == BACKEND_CANCELLED) &&
+        attempts[1].status != BACKEND_CANCELLED)
+        winner = 1;
+    if (count == 2 && config.debug)
+        printf("ddn:run_hedged(): host %d answered first\n", (first + winner) % remote->count);
+
+    *output = attempts[winner].output;
+    *errors = attempts[winner].errors;
+    free(attempts[1 - winner].output.data);
+    free(attempts[1 - winner].errors);
+    return attempts[winner].status;
+}
+
+// Wait before the next attempt, longer each time with some jitter so that
+// the runs sharing a host don't all come back at once. Returns -1 when the
+// distro's deadline would pass first.
+static int wait_backoff(remote_t *remote, int attempt) {
+    unsigned int seed = (unsigned int)stats_now();
+    long long delay = (RETRY_BACKOFF_MS * NS_PER_MS) << (attempt - 1);
+    delay += delay * (rand_r(&seed) % 50) / 100;
+
+    if (remote->deadline && stats_now() + delay >= remote->deadline) return -1;
+
+    struct timespec ts = { .tv_sec = delay / NS_PER_SEC, .tv_nsec = delay % NS_PER_SEC };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+    return 0;
+}
+
+int remote_run(remote_t *remote, const char *command, line_fn_t fn, void *arg, char **errors) {
+    if (errors) *errors = NULL;
+    if (remote->count == 0) return -1;
+
+    // Without a replica to hedge on, lines go to 'fn' as they arrive
+    int hedged = remote->count > 1 && config.hedge_delay > 0;
+
+    int status = REMOTE_NOT_RUN;
+    for (int attempt = 0; attempt <= config.retries; attempt++) {
+        if (attempt > 0) {
+            if (wait_backoff(remote, attempt) != 0) break;
+            stats_add(STAT_RETRIES, 1);
+        }
+
+        long long now = stats_now();
+        if (remote->deadline && now >= remote->deadline) break;
+        long long deadline = config.timeout > 0 ? now + config.timeout * NS_PER_SEC : 0;
+        if (remote->deadline && (!deadline || remote->deadline < deadline))
+            deadline = remote->deadline;
+
+        // Retries go to the next host, a replica may be fine
+        int host = attempt % remote->count;
+        stream_t stream = { .fn = fn, .arg = arg };
+        char *attempt_errors = NULL;
+
+        if (hedged) {
+            output_buffer_t output = {0};
+            status = run_hedged(remote, host, command, deadline, &output, &attempt_errors);
+            if (status == OUTPUT_OVERFLOWED) {
+                if (config.debug)
+                    printf("ddn:remote_run(): output over %d bytes, running it again unhedged\n",
+                           OUTPUT_MAX_BUFFERED);
+                free(attempt_errors);
+                attempt_errors = NULL;
+                hedged = 0;
+            } else if (!is_transient(status)) {
+                replay_lines(&output, fn, arg);
+            }
+            free(output.data);
+        }
+        if (!hedged) {
+            status = backend_run_until(remote->hosts[host], command, stream_line, &stream,
+                                       &attempt_errors, deadline, NULL);
+            if (status == BACKEND_TIMED_OUT) stats_add(STAT_TIMEOUTS, 1);
+        }
+
+        if (errors) {
+            free(*errors);
+            *errors = attempt_errors;
+        } else {
+            free(attempt_errors);
+        }
+
+        // Lines already passed on can't be taken back, a retry would repeat them
+        if (!is_transient(status) || stream.lines > 0) return status;
+
+        if (config.debug)
+            printf("ddn:remote_run(): attempt %d failed (%s, status %d)\n", attempt + 1,
+                   remote_failure_name(remote_failure(status)), status);
+    }
+
+    return status;
+}
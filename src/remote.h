@@ -0,0 +1,50 @@
+#ifndef REMOTE_H
+#define REMOTE_H 1
+
+#include "backend.h"
+
+// Queries on a distro's hosts that can't hang a run: each command has a
+// deadline, transient failures are retried and a slow command can be
+// raced by a hedged copy on a replica host.
+
+#define REMOTE_MAX_HOSTS 4
+
+// Exit status of commands not run because the distro's deadline had passed
+#define REMOTE_NOT_RUN -4
+
+// Hosts a distro's commands run on, from DISTRO_VM_<name>: the first one,
+// then its replicas
+typedef struct {
+    backend_t *hosts[REMOTE_MAX_HOSTS];
+    int count;
+    long long deadline;         // stats_now() time the distro's commands must end by, 0 for none
+} remote_t;
+
+// Why a command gave no usable output
+typedef enum {
+    REMOTE_OK,
+    REMOTE_TIMEOUT,             // Killed at its deadline
+    REMOTE_DEADLINE,            // Not run, the distro's deadline had passed
+    REMOTE_CONNECTION,          // SSH or container error, or it couldn't be started
+    REMOTE_COMMAND              // Package manager missing or not executable
+} remote_failure_t;
+
+// Failure of a remote_run() exit status
+remote_failure_t remote_failure(int status);
+
+// Short name of a failure for the output, "timeout", "connection"...
+const char* remote_failure_name(remote_failure_t failure);
+
+// Failure of such a name, REMOTE_CONNECTION for unknown names
+remote_failure_t parse_remote_failure(const char *name);
+
+// Run a command on the hosts within the --timeout and --distro-timeout
+// deadlines, retried up to --retries times on the next host while it fails
+// on its way (timeouts, SSH and container errors). Lines reach 'fn' as they
+// arrive, and a command that already gave some isn't retried. Hedged
+// commands keep their output until one of them wins, up to 8MiB: past that
+// the command is run again without hedging.
+// Returns the exit status as backend_run() does, or REMOTE_NOT_RUN.
+int remote_run(remote_t *remote, const char *command, line_fn_t fn, void *arg, char **errors);
+
+#endif // REMOTE_H
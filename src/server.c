@@ -0,0 +1,588 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "ddn_config.h"
+#include "server.h"
+#include "distro.h"
+#include "mapping.h"
+
+#define PROTOCOL_VERSION 3
+#define LISTEN_BACKLOG 64
+#define POLL_INTERVAL_MS 500
+
+// Protocol, one request per connection, all lines end with '\n':
+//
+//   client: resolve <version> <distro> <exact|names> <rules>
+//           <type>\t<name>                 one line per dependency
+//           (empty line)
+//   server: <source>\t<packages>           one line per dependency, in order
+//           ok
+//
+// or "error <message>" at any point. Types are the letters of the cache
+// files, packages are in the cache format and sources are letters too.
+// Failed dependencies have the name of their failure instead of packages.
+// Rules is mapping_hash() in hex, clients mapping headers with other rules
+// than the server's get an error.
+static const char source_chars[] = "nicqf";
+
+// Where a dependency stands on the server
+typedef enum {
+    ENTRY_NEW,          // Never resolved, or the result is too old
+    ENTRY_QUEUED,       // Waiting for the next round of queries
+    ENTRY_RUNNING,      // Being resolved
+    ENTRY_DONE
+} entry_state_t;
+
+typedef struct {
+    entry_state_t state;
+    resolution_source_t source;
+    remote_failure_t failure;
+    char *packages;
+    time_t resolved;
+} served_entry_t;
+
+// Dependencies asked for on one distro. Queued dependencies are resolved by
+// whichever client finds no round of queries running, for every client.
+typedef struct {
+    const char *distro_name;
+    dependency_list_t *keys;    // Every dependency asked for
+    served_entry_t *entries;    // One per key
+    int entry_capacity;
+    int *queue;                 // Key indexes waiting for a round of queries
+    int queue_count;
+    int queue_capacity;
+    int resolving;              // A round of queries is running
+} served_distro_t;
+
+static pthread_mutex_t served_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t served_cond = PTHREAD_COND_INITIALIZER;
+static served_distro_t **served;    // Not moved while their lock is released
+static int served_count;
+static int active_clients;
+
+static volatile sig_atomic_t stopping;
+
+char* get_server_socket_path(void) {
+    if (config.socket_path) return strdup(config.socket_path);
+
+    char *path = NULL;
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    int ret = runtime_dir && *runtime_dir ?
+              asprintf(&path, "%s/distro-dep-name.sock", runtime_dir) :
+              asprintf(&path, "/tmp/distro-dep-name-%d.sock", (int)getuid());
+
+    return ret < 0 ? NULL : path;
+}
+
+// Fill a socket address, returns 0 on success
+static int get_socket_address(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "Error: socket path '%s' is too long\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+// Connect to the server, returns the socket or -1
+static int connect_server(const char *path) {
+    struct sockaddr_un addr;
+    if (get_socket_address(path, &addr) != 0) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Write a whole buffer, without SIGPIPE if the other end is gone
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return -1;
+        data += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+static served_distro_t* get_served_distro(const char *distro_name) {
+    for (int i = 0; i < served_count; i++) {
+        if (strcmp(served[i]->distro_name, distro_name) == 0) return served[i];
+    }
+
+    served_distro_t **tmp = realloc(served, (served_count + 1) * sizeof(served_distro_t*));
+    if (!tmp) return NULL;
+    served = tmp;
+
+    served_distro_t *distro = calloc(1, sizeof(served_distro_t));
+    if (!distro) return NULL;
+    distro->keys = create_dependency_list();
+    if (!distro->keys) {
+        free(distro);
+        return NULL;
+    }
+    distro->distro_name = get_distro_by_name(distro_name)->name;
+    served[served_count++] = distro;
+
+    return distro;
+}
+
+// Get the entry of a dependency, added if it's new. Called with the lock held.
+static int get_entry(served_distro_t *distro, const dependency_t *dep) {
+    int index = find_dependency(distro->keys, dep->name, dep->type);
+    if (index >= 0) return index;
+
+    if (distro->keys->count >= distro->entry_capacity) {
+        int capacity = distro->entry_capacity ? distro->entry_capacity * 2 : 64;
+        served_entry_t *entries = realloc(distro->entries, capacity * sizeof(served_entry_t));
+        if (!entries) return -1;
+        distro->entries = entries;
+        distro->entry_capacity = capacity;
+    }
+
+    add_dependency(distro->keys, dep->name, dep->type);
+    index = find_dependency(distro->keys, dep->name, dep->type);
+    if (index >= 0) memset(&distro->entries[index], 0, sizeof(served_entry_t));
+
+    return index;
+}
+
+static int queue_entry(served_distro_t *distro, int index) {
+    if (distro->queue_count >= distro->queue_capacity) {
+        int capacity = distro->queue_capacity ? distro->queue_capacity * 2 : 64;
+        int *queue = realloc(distro->queue, capacity * sizeof(int));
+        if (!queue) return -1;
+        distro->queue = queue;
+        distro->queue_capacity = capacity;
+    }
+
+    distro->queue[distro->queue_count++] = index;
+    distro->entries[index].state = ENTRY_QUEUED;
+    return 0;
+}
+
+// Resolve everything queued on a distro in one go, the lock is released
+// while the queries run and held again on return
+static void run_queries(served_distro_t *distro) {
+    dependency_list_t *batch = create_dependency_list();
+    int count = distro->queue_count;
+    int *indexes = malloc((count + 1) * sizeof(int));
+    if (!batch || !indexes) {
+        // Given up rather than retried, the clients get no packages
+        for (int i = 0; i < count; i++) {
+            distro->entries[distro->queue[i]].state = ENTRY_DONE;
+            distro->entries[distro->queue[i]].source = RESOLVED_NONE;
+        }
+        distro->queue_count = 0;
+        free_dependency_list(batch);
+        free(indexes);
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        indexes[i] = distro->queue[i];
+        dependency_t *dep = &distro->keys->items[indexes[i]];
+        add_dependency(batch, dep->name, dep->type);
+        distro->entries[indexes[i]].state = ENTRY_RUNNING;
+    }
+    distro->queue_count = 0;
+    distro->resolving = 1;
+    pthread_mutex_unlock(&served_lock);
+
+    if (config.debug)
+        printf("ddn:run_queries(): %s: resolving %d dependencies\n", distro->distro_name, count);
+
+    resolution_details_t details = {0};
+    free_package_list(query_distro_packages(distro->distro_name, batch, &details));
+
+    pthread_mutex_lock(&served_lock);
+    for (int i = 0; i < count; i++) {
+        served_entry_t *entry = &distro->entries[indexes[i]];
+        free(entry->packages);
+        entry->packages = format_package_string(i < details.count ? details.packages[i] : NULL);
+        entry->source = i < details.count ? details.sources[i] : RESOLVED_NONE;
+        entry->failure = i < details.count ? details.failures[i] : REMOTE_OK;
+        entry->resolved = time(NULL);
+        entry->state = ENTRY_DONE;
+    }
+    distro->resolving = 0;
+    pthread_cond_broadcast(&served_cond);
+
+    free_resolution_details(&details);
+    free_dependency_list(batch);
+    free(indexes);
+}
+
+// Resolve a client's dependencies, 'sources', 'failures' and 'packages' get the
+// result of each one. Returns 0 on success.
+static int resolve_served(const char *distro_name, dependency_list_t *deps,
+                          resolution_source_t *sources, remote_failure_t *failures,
+                          char **packages) {
+    int *indexes = malloc((deps->count + 1) * sizeof(int));
+    if (!indexes) return -1;
+
+    pthread_mutex_lock(&served_lock);
+    served_distro_t *distro = get_served_distro(distro_name);
+    if (!distro) {
+        pthread_mutex_unlock(&served_lock);
+        free(indexes);
+        return -1;
+    }
+
+    // Failed resolutions and results older than the cache TTL are asked again,
+    // dependencies already on their way are only waited for
+    time_t now = time(NULL);
+    int queued = 0;
+    for (int i = 0; i < deps->count; i++) {
+        int index = indexes[i] = get_entry(distro, &deps->items[i]);
+        if (index < 0) continue;
+
+        served_entry_t *entry = &distro->entries[index];
+        if (entry->state == ENTRY_DONE &&
+            (entry->source == RESOLVED_NONE || entry->source == RESOLVED_FAILED ||
+             now - entry->resolved >= config.cache_ttl))
+            entry->state = ENTRY_NEW;
+        if (entry->state == ENTRY_NEW && queue_entry(distro, index) == 0) queued++;
+    }
+
+    if (config.debug)
+        printf("ddn:resolve_served(): %s: %d dependencies, %d new\n", distro_name, deps->count,
+               queued);
+
+    while (1) {
+        if (distro->queue_count > 0 && !distro->resolving) {
+            run_queries(distro);
+            continue;
+        }
+
+        int done = 1;
+        for (int i = 0; i < deps->count && done; i++) {
+            done = indexes[i] < 0 || distro->entries[indexes[i]].state == ENTRY_DONE;
+        }
+        if (done) break;
+
+        pthread_cond_wait(&served_cond, &served_lock);
+    }
+
+    for (int i = 0; i < deps->count; i++) {
+        served_entry_t *entry = indexes[i] >= 0 ? &distro->entries[indexes[i]] : NULL;
+        sources[i] = entry ? entry->source : RESOLVED_NONE;
+        failures[i] = entry ? entry->failure : REMOTE_OK;
+        packages[i] = strdup(entry && entry->packages ? entry->packages : "");
+    }
+    pthread_mutex_unlock(&served_lock);
+
+    free(indexes);
+    return 0;
+}
+
+// Read a request, resolve it and answer
+static void serve_client(int fd) {
+    FILE *in = fdopen(dup(fd), "r");
+    if (!in) return;
+
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    char distro_name[64], mode[16];
+    int version = 0;
+    unsigned long long rules = 0;
+    int fields = 0;
+    const char *error = NULL;
+    dependency_list_t *deps = create_dependency_list();
+
+    if (getline(&line, &size, in) > 0)
+        fields = sscanf(line, "resolve %d %63s %15s %llx", &version, distro_name, mode, &rules);
+
+    // The version first, older clients send fewer fields
+    if (fields < 1) {
+        error = "bad request";
+    } else if (version != PROTOCOL_VERSION) {
+        error = "unsupported protocol version";
+    } else if (fields != 4) {
+        error = "bad request";
+    } else if (rules != mapping_hash()) {
+        error = "server runs with other mapping rules";
+    } else if (!get_distro_by_name(distro_name)) {
+        error = "unknown distro";
+    } else if ((strcmp(mode, "exact") == 0) != config.exact) {
+        error = config.exact ? "server runs with --exact" : "server runs without --exact";
+    } else if (!deps) {
+        error = "out of memory";
+    }
+
+    while (!error && (len = getline(&line, &size, in)) > 0) {
+        if (line[len - 1] == '\n') line[--len] = '\0';
+        if (len == 0) break;
+
+        dependency_type_t type;
+        if (len < 3 || line[1] != '\t' || dependency_type_from_char(line[0], &type) != 0) {
+            error = "bad dependency";
+            break;
+        }
+        add_dependency(deps, line + 2, type);
+    }
+    free(line);
+    fclose(in);
+
+    char *response = NULL;
+    size_t response_len = 0;
+    FILE *out = open_memstream(&response, &response_len);
+    if (!out) {
+        free_dependency_list(deps);
+        return;
+    }
+
+    resolution_source_t *sources = NULL;
+    remote_failure_t *failures = NULL;
+    char **packages = NULL;
+    if (!error) {
+        sources = calloc(deps->count + 1, sizeof(resolution_source_t));
+        failures = calloc(deps->count + 1, sizeof(remote_failure_t));
+        packages = calloc(deps->count + 1, sizeof(char*));
+        if (!sources || !failures || !packages ||
+            resolve_served(distro_name, deps, sources, failures, packages) != 0)
+            error = "resolution failed";
+    }
+
+    if (error) {
+        fprintf(out, "error %s\n", error);
+        if (config.debug)
+            printf("ddn:serve_client(): %s\n", error);
+    } else {
+        for (int i = 0; i < deps->count; i++) {
+            if (sources[i] == RESOLVED_FAILED)
+                fprintf(out, "%c\t%s\n", source_chars[sources[i]], remote_failure_name(failures[i]));
+            else
+                fprintf(out, "%c\t%s\n", source_chars[sources[i]], packages[i] ? packages[i] : "");
+        }
+        fprintf(out, "ok\n");
+    }
+    fclose(out);
+
+    send_all(fd, response, response_len);
+    free(response);
+
+    for (int i = 0; packages && i < deps->count; i++) {
+        free(packages[i]);
+    }
+    free(packages);
+    free(failures);
+    free(sources);
+    free_dependency_list(deps);
+}
+
+static void* client_thread(void *arg) {
+    int fd = (int)(long)arg;
+    serve_client(fd);
+    close(fd);
+
+    pthread_mutex_lock(&served_lock);
+    active_clients--;
+    pthread_cond_broadcast(&served_cond);
+    pthread_mutex_unlock(&served_lock);
+
+    return NULL;
+}
+
+static void handle_stop(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+static void free_served(void) {
+    for (int i = 0; i < served_count; i++) {
+        for (int j = 0; j < served[i]->keys->count; j++) {
+            free(served[i]->entries[j].packages);
+        }
+        free(served[i]->entries);
+        free(served[i]->queue);
+        free_dependency_list(served[i]->keys);
+        free(served[i]);
+    }
+    free(served);
+    served = NULL;
+    served_count = 0;
+}
+
+int run_server(void) {
+    char *path = get_server_socket_path();
+    struct sockaddr_un addr;
+    if (!path || get_socket_address(path, &addr) != 0) {
+        free(path);
+        return 1;
+    }
+
+    // A socket left behind by a server that's gone is replaced, a live one isn't
+    int other = connect_server(path);
+    if (other >= 0) {
+        close(other);
+        fprintf(stderr, "Error: a server is already running on '%s'\n", path);
+        free(path);
+        return 1;
+    }
+    unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(fd, LISTEN_BACKLOG) != 0) {
+        fprintf(stderr, "Error: cannot listen on '%s': %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        free(path);
+        return 1;
+    }
+
+    struct sigaction action = {0};
+    action.sa_handler = handle_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    fprintf(stderr, "Serving resolutions on %s\n", path);
+
+    // The signal may land on any thread, so the flag is checked between polls
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    while (!stopping) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, POLL_INTERVAL_MS) <= 0) continue;
+
+        int client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0) continue;
+
+        pthread_mutex_lock(&served_lock);
+        active_clients++;
+        pthread_mutex_unlock(&served_lock);
+
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, client_thread, (void*)(long)client) != 0)
+            client_thread((void*)(long)client);
+    }
+    pthread_attr_destroy(&attr);
+
+    close(fd);
+    unlink(path);
+    free(path);
+
+    // Requests being resolved still get their answer
+    pthread_mutex_lock(&served_lock);
+    while (active_clients > 0) {
+        pthread_cond_wait(&served_cond, &served_lock);
+    }
+    free_served();
+    pthread_mutex_unlock(&served_lock);
+    close_kept_backends();
+
+    fprintf(stderr, "Server stopped\n");
+    return 0;
+}
+
+int server_resolve(const char *distro_name, dependency_list_t *deps, package_list_t **packages,
+                   resolution_source_t *sources, remote_failure_t *failures) {
+    // These ask for another kind of resolution than a shared server gives
+    if (config.no_server || config.offline || config.no_cache || config.refresh_cache)
+        return -1;
+
+    char *path = get_server_socket_path();
+    int fd = path ? connect_server(path) : -1;
+    free(path);
+    if (fd < 0) return -1;
+
+    // A server stuck on a VM counts as no server once the distro's time is up
+    if (config.distro_timeout > 0) {
+        struct timeval timeout = { .tv_sec = config.distro_timeout };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+
+    char *request = NULL;
+    size_t request_len = 0;
+    FILE *out = open_memstream(&request, &request_len);
+    if (!out) {
+        close(fd);
+        return -1;
+    }
+    fprintf(out, "resolve %d %s %s %016llx\n", PROTOCOL_VERSION, distro_name,
+            config.exact ? "exact" : "names", (unsigned long long)mapping_hash());
+    for (int i = 0; i < deps->count; i++) {
+        fprintf(out, "%c\t%s\n", dependency_type_char(deps->items[i].type), deps->items[i].name);
+    }
+    fprintf(out, "\n");
+    fclose(out);
+
+    int sent = send_all(fd, request, request_len);
+    free(request);
+    FILE *in = sent == 0 ? fdopen(fd, "r") : NULL;
+    if (!in) {
+        close(fd);
+        return -1;
+    }
+
+    // The whole answer is read before anything is used, so that a server
+    // going away halfway leaves the packages untouched for a local resolution
+    char **lines = calloc(deps->count + 1, sizeof(char*));
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    int count = 0, ok = 0;
+    while (lines && (len = getline(&line, &size, in)) > 0) {
+        if (line[len - 1] == '\n') line[--len] = '\0';
+        if (count == deps->count) {
+            ok = strcmp(line, "ok") == 0;
+            break;
+        }
+        if (len < 2 || line[1] != '\t' || !strchr(source_chars, line[0])) {
+            if (strncmp(line, "error ", 6) == 0)
+                fprintf(stderr, "Warning: resolution server: %s, resolving locally\n", line + 6);
+            break;
+        }
+        lines[count++] = line;
+        line = NULL;
+        size = 0;
+    }
+    if (!ok && ferror(in) && (errno == EAGAIN || errno == EWOULDBLOCK))
+        fprintf(stderr, "Warning: resolution server: no answer after %lds, resolving locally\n",
+                config.distro_timeout);
+    free(line);
+    fclose(in);
+
+    if (ok) {
+        for (int i = 0; i < count; i++) {
+            sources[i] = strchr(source_chars, lines[i][0]) - source_chars;
+            if (sources[i] == RESOLVED_FAILED)
+                failures[i] = parse_remote_failure(lines[i] + 2);
+            else if (packages[i])
+                add_package_string(packages[i], lines[i] + 2);
+        }
+        if (config.debug)
+            printf("ddn:server_resolve(): %s: %d dependencies resolved by the server\n",
+                   distro_name, count);
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(lines[i]);
+    }
+    free(lines);
+
+    return ok ? 0 : -1;
+}
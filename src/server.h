@@ -0,0 +1,24 @@
+#ifndef SERVER_H
+#define SERVER_H 1
+
+#include "parser.h"
+#include "vm_query.h"
+
+// Resolution server: one process keeps the VM connections and the resolved
+// dependencies in memory and answers the other runs over a Unix socket.
+// Dependencies asked for by several clients at once are only queried once.
+
+// Get the socket path: the one given with --socket, $XDG_RUNTIME_DIR/distro-dep-name.sock
+// or /tmp/distro-dep-name-<uid>.sock. The result must be freed.
+char* get_server_socket_path(void);
+
+// Serve resolutions until SIGINT or SIGTERM, returns the exit status
+int run_server(void);
+
+// Resolve a distro's dependencies through a running server, 'packages',
+// 'sources' and 'failures' get the result of each dependency. Returns 0 on
+// success, -1 if there's no server to ask or it didn't answer.
+int server_resolve(const char *distro_name, dependency_list_t *deps, package_list_t **packages,
+                   resolution_source_t *sources, remote_failure_t *failures);
+
+#endif // SERVER_H
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ddn_config.h"
+#include "stats.h"
+
+// One finished span, kept for the trace file
+typedef struct {
+    stats_span_t span;
+    char *detail;
+    long long start;
+    long long duration;
+    int tid;
+} trace_event_t;
+
+int stats_enabled;
+atomic_long stats_counters[STAT_COUNT];
+
+static const char *span_names[SPAN_COUNT] = {
+    [SPAN_WALK] = "walk",
+    [SPAN_PARSE] = "parse",
+    [SPAN_DISTRO] = "distro",
+    [SPAN_COMMAND] = "command",
+    [SPAN_WARMUP] = "warm-up",
+};
+
+static const char *counter_names[STAT_COUNT] = {
+    [STAT_FILES_SCANNED] = "files scanned",
+    [STAT_FILES_PARSED] = "files parsed",
+    [STAT_BYTES_READ] = "bytes read",
+    [STAT_INCLUDES] = "includes seen",
+    [STAT_UNIQUE_DEPS] = "unique dependencies",
+    [STAT_SYSTEM_HEADERS] = "system headers",
+    [STAT_REMOTE_COMMANDS] = "remote commands",
+    [STAT_RETRIES] = "retried commands",
+    [STAT_HEDGED] = "hedged commands",
+    [STAT_TIMEOUTS] = "timed out commands",
+    [STAT_INDEX_HITS] = "index hits",
+    [STAT_CACHE_HITS] = "cache hits",
+};
+
+static int show_summary;
+static const char *trace_file;
+static long long run_start;
+
+static atomic_long span_counts[SPAN_COUNT];
+static atomic_llong span_totals[SPAN_COUNT];
+static atomic_llong span_max[SPAN_COUNT];
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_event_t *events;
+static int event_count;
+static int event_capacity;
+
+// Monotonic time in nanoseconds
+long long stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int stats_init(int summary, const char *trace_path) {
+    show_summary = summary;
+    trace_file = trace_path;
+    stats_enabled = summary || trace_path;
+    run_start = stats_now();
+
+    // Fail early rather than after the whole run
+    if (trace_file) {
+        FILE *f = fopen(trace_file, "w");
+        if (!f) {
+            fprintf(stderr, "Error: cannot write trace file '%s': %s\n", trace_file, strerror(errno));
+            return -1;
+        }
+        fclose(f);
+    }
+
+    return 0;
+}
+
+void stats_record(stats_span_t span, long long start, const char *detail) {
+    long long duration = stats_now() - start;
+
+    atomic_fetch_add_explicit(&span_counts[span], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&span_totals[span], duration, memory_order_relaxed);
+    long long max = atomic_load_explicit(&span_max[span], memory_order_relaxed);
+    while (duration > max &&
+           !atomic_compare_exchange_weak_explicit(&span_max[span], &max, duration,
+                                                  memory_order_relaxed, memory_order_relaxed))
+        ;
+
+    if (!trace_file) return;
+
+    pthread_mutex_lock(&trace_lock);
+    if (event_count >= event_capacity) {
+        int capacity = event_capacity ? event_capacity * 2 : 256;
+        trace_event_t *tmp = realloc(events, capacity * sizeof(trace_event_t));
+        if (!tmp) {
+            pthread_mutex_unlock(&trace_lock);
+            return;
+        }
+        events = tmp;
+        event_capacity = capacity;
+    }
+
+    trace_event_t *event = &events[event_count++];
+    event->span = span;
+    event->detail = detail ? strdup(detail) : NULL;
+    event->start = start;
+    event->duration = duration;
+    event->tid = gettid();
+    pthread_mutex_unlock(&trace_lock);
+}
+
+static void print_summary(void) {
+    double total = (stats_now() - run_start) / 1e6;
+
+    fprintf(stderr, "\n%-22s %8s %12s %12s\n", "span", "count", "total ms", "max ms");
+    for (int i = 0; i < SPAN_COUNT; i++) {
+        fprintf(stderr, "%-22s %8ld %12.3f %12.3f\n", span_names[i],
+                atomic_load(&span_counts[i]), atomic_load(&span_totals[i]) / 1e6,
+                atomic_load(&span_max[i]) / 1e6);
+    }
+    fprintf(stderr, "%-22s %8s %12.3f\n", "run", "", total);
+
+    fprintf(stderr, "\n%-22s %8s\n", "counter", "value");
+    for (int i = 0; i < STAT_COUNT; i++) {
+        fprintf(stderr, "%-22s %8ld\n", counter_names[i], atomic_load(&stats_counters[i]));
+    }
+}
+
+// Write a JSON string
+static void write_json_string(FILE *f, const char *str) {
+    fputc('"', f);
+    for (const unsigned char *p = (const unsigned char*)str; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(f, "\\%c", *p);
+        } else if (*p < 0x20) {
+            fprintf(f, "\\u%04x", *p);
+        } else {
+            fputc(*p, f);
+        }
+    }
+    fputc('"', f);
+}
+
+// Chrome trace event format, complete events with microsecond times
+static void write_trace(void) {
+    FILE *f = fopen(trace_file, "w");
+    if (!f) {
+        fprintf(stderr, "Error: cannot write trace file '%s': %s\n", trace_file, strerror(errno));
+        return;
+    }
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (int i = 0; i < event_count; i++) {
+        trace_event_t *event = &events[i];
+        fprintf(f, "{\"name\":\"%s\",\"cat\":\"ddn\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                "\"pid\":%d,\"tid\":%d",
+                span_names[event->span], (event->start - run_start) / 1e3,
+                event->duration / 1e3, (int)getpid(), event->tid);
+        if (event->detail) {
+            fprintf(f, ",\"args\":{\"detail\":");
+            write_json_string(f, event->detail);
+            fputc('}', f);
+        }
+        fprintf(f, "}%s\n", i + 1 < event_count ? "," : "");
+    }
+    fprintf(f, "],\"displayTimeUnit\":\"ms\"}\n");
+
+    if (fclose(f) != 0)
+        fprintf(stderr, "Error: cannot write trace file '%s': %s\n", trace_file, strerror(errno));
+    else if (config.debug)
+        fprintf(stderr, "ddn:write_trace(): wrote %d events to '%s'\n", event_count, trace_file);
+}
+
+void stats_finish(void) {
+    if (!stats_enabled) return;
+
+    if (show_summary) print_summary();
+    if (trace_file) write_trace();
+
+    for (int i = 0; i < event_count; i++) {
+        free(events[i].detail);
+    }
+    free(events);
+    events = NULL;
+    event_count = event_capacity = 0;
+}
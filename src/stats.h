@@ -0,0 +1,59 @@
+#ifndef STATS_H
+#define STATS_H 1
+
+#include <stdatomic.h>
+
+// Timed parts of a run
+typedef enum {
+    SPAN_WALK,          // Directory walk
+    SPAN_PARSE,         // Parsing the files found
+    SPAN_DISTRO,        // Resolving the dependencies of one distro
+    SPAN_COMMAND,       // One command run through a backend
+    SPAN_WARMUP,        // Dumping a distro's package list before its searches
+    SPAN_COUNT
+} stats_span_t;
+
+typedef enum {
+    STAT_FILES_SCANNED,
+    STAT_FILES_PARSED,
+    STAT_BYTES_READ,
+    STAT_INCLUDES,
+    STAT_UNIQUE_DEPS,
+    STAT_SYSTEM_HEADERS,
+    STAT_REMOTE_COMMANDS,
+    STAT_RETRIES,
+    STAT_HEDGED,
+    STAT_TIMEOUTS,
+    STAT_INDEX_HITS,
+    STAT_CACHE_HITS,
+    STAT_COUNT
+} stats_counter_t;
+
+// Set when --stats or --trace is given, everything else is a no-op without it
+extern int stats_enabled;
+extern atomic_long stats_counters[STAT_COUNT];
+
+// Start collecting, with a summary and/or a trace file written by stats_finish()
+int stats_init(int summary, const char *trace_path);
+
+// Print the summary and write the trace file
+void stats_finish(void);
+
+long long stats_now(void);
+void stats_record(stats_span_t span, long long start, const char *detail);
+
+// Start time of a span
+static inline long long stats_begin(void) {
+    return stats_enabled ? stats_now() : 0;
+}
+
+// End a span started at 'start', 'detail' only shows in the trace
+static inline void stats_end(stats_span_t span, long long start, const char *detail) {
+    if (stats_enabled) stats_record(span, start, detail);
+}
+
+static inline void stats_add(stats_counter_t counter, long value) {
+    if (stats_enabled) atomic_fetch_add_explicit(&stats_counters[counter], value, memory_order_relaxed);
+}
+
+#endif // STATS_H
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ddn_config.h"
+#include "sysheaders.h"
+#include "mapping.h"
+#include "stats.h"
+
+#define MAX_COMPILER_DIRS 32
+
+// Directories of the compiler's own headers
+static char *compiler_dirs[MAX_COMPILER_DIRS];
+static int compiler_dir_count;
+
+// Directories of the compiler's builtin headers and of the C++ library,
+// /usr/include and the like also hold the headers of packages
+static int is_compiler_dir(const char *dir) {
+    return strstr(dir, "/gcc/") || strstr(dir, "/gcc-lib/") || strstr(dir, "/clang/") ||
+           strstr(dir, "/c++/");
+}
+
+static void add_compiler_dir(const char *dir) {
+    char *resolved = realpath(dir, NULL);
+    if (!resolved) return;
+
+    int known = !is_compiler_dir(resolved) || compiler_dir_count >= MAX_COMPILER_DIRS;
+    for (int i = 0; i < compiler_dir_count && !known; i++) {
+        known = strcmp(compiler_dirs[i], resolved) == 0;
+    }
+    if (known) {
+        free(resolved);
+        return;
+    }
+
+    if (config.debug)
+        printf("ddn:add_compiler_dir(): '%s'\n", resolved);
+    compiler_dirs[compiler_dir_count++] = resolved;
+}
+
+// Read the search list printed by 'cc -E -v' for one language
+static void probe_language(const char *compiler, const char *language) {
+    char *command = NULL;
+    if (asprintf(&command, "%s -E -v -x %s /dev/null 2>&1 >/dev/null", compiler, language) < 0)
+        return;
+
+    if (config.debug)
+        printf("ddn:probe_language(): running '%s'\n", command);
+
+    FILE *pipe = popen(command, "r");
+    free(command);
+    if (!pipe) return;
+
+    char line[4096];
+    int in_list = 0;
+    while (fgets(line, sizeof(line), pipe)) {
+        line[strcspn(line, "\n")] = '\0';
+
+        if (strncmp(line, "#include <...> search starts here:", 34) == 0) {
+            in_list = 1;
+        } else if (strncmp(line, "End of search list.", 19) == 0) {
+            in_list = 0;
+        } else if (in_list && line[0] == ' ') {
+            // Frameworks and the like have a suffix after the path
+            char *dir = line + 1;
+            char *suffix = strstr(dir, " (");
+            if (suffix) *suffix = '\0';
+            add_compiler_dir(dir);
+        }
+    }
+
+    pclose(pipe);
+}
+
+int probe_compiler_headers(const char *compiler) {
+    probe_language(compiler, "c");
+    probe_language(compiler, "c++");
+
+    if (compiler_dir_count == 0)
+        fprintf(stderr, "Warning: no include directories found with '%s -E -v'\n", compiler);
+
+    return compiler_dir_count;
+}
+
+int is_system_header(const char *header) {
+    const char *library;
+    if (mapping_lookup(header, &library) == MAPPING_SYSTEM) return 1;
+
+    char path[4096];
+    struct stat st;
+    for (int i = 0; i < compiler_dir_count; i++) {
+        snprintf(path, sizeof(path), "%s/%s", compiler_dirs[i], header);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) return 1;
+    }
+
+    return 0;
+}
+
+dependency_list_t* filter_system_headers(dependency_list_t *deps) {
+    dependency_list_t *filtered = create_dependency_list();
+    if (!filtered) return NULL;
+
+    int skipped = 0;
+    for (int i = 0; i < deps->count; i++) {
+        dependency_t *dep = &deps->items[i];
+        if (dep->type == DEP_TYPE_HEADER && is_system_header(dep->name)) {
+            if (config.debug)
+                printf("ddn:filter_system_headers(): skipping '%s'\n", dep->name);
+            skipped++;
+            continue;
+        }
+        add_dependency_status(filtered, dep->name, dep->type, dep->status);
+    }
+
+    stats_add(STAT_SYSTEM_HEADERS, skipped);
+
+    return filtered;
+}
+
+void free_compiler_headers(void) {
+    for (int i = 0; i < compiler_dir_count; i++) {
+        free(compiler_dirs[i]);
+    }
+    compiler_dir_count = 0;
+}
@@ -0,0 +1,20 @@
+#ifndef SYSHEADERS_H
+#define SYSHEADERS_H 1
+
+#include "parser.h"
+
+// Find the include directories of the compiler itself (its builtin headers
+// and C++ library) with 'cc -E -v', returns the number of directories found
+int probe_compiler_headers(const char *compiler);
+
+// Whether a header comes with the C library or the compiler:
+// a system rule of the mapping, or a file in the probed directories
+int is_system_header(const char *header);
+
+// Get a copy of the list without the system headers
+dependency_list_t* filter_system_headers(dependency_list_t *deps);
+
+// Free the probed directories
+void free_compiler_headers(void);
+
+#endif // SYSHEADERS_H
@@ -1,94 +1,133 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-// ddn test
-#include <jansson.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "ddn_config.h"
 #include "vm_query.h"
 #include "distro.h"
+#include "backend.h"
+#include "pool.h"
+#include "cache.h"
+#include "pkgindex.h"
+#include "hash.h"
+#include "mapping.h"
+#include "stats.h"
+#include "output.h"
+#include "server.h"
 
 #define INITIAL_CAPACITY 32
 #define MAX_CMD_LEN 2048
-#define MAX_OUTPUT_LEN 8192
+#define BATCH_MAX_SCRIPT 65536
+#define BATCH_TAG "@@ddn-dep:"
+#define BATCH_STATUS_TAG "@@ddn-status:"
+#define INDEX_MAX_MATCHES 8
+#define APT_MAX_RESULTS 5
+#define HOST_SEPARATORS ", \t"
+#define NS_PER_SEC 1000000000LL
+#define WARM_UP_MIN_SEARCHES 2
+#define COOL_DOWN_TIMEOUT 10
 
 static package_list_t* create_package_list(void) {
     package_list_t *list = malloc(sizeof(package_list_t));
     if (!list) return NULL;
 
     list->items = malloc(INITIAL_CAPACITY * sizeof(package_t));
-    if (!list->items) {
+    list->buckets = malloc(INITIAL_CAPACITY * 2 * sizeof(int));
+    if (!list->items || !list->buckets) {
+        free(list->items);
+        free(list->buckets);
         free(list);
         return NULL;
     }
+    memset(list->buckets, 0xff, INITIAL_CAPACITY * 2 * sizeof(int));
 
     list->count = 0;
     list->capacity = INITIAL_CAPACITY;
+    list->bucket_count = INITIAL_CAPACITY * 2;
+    list->strings = (arena_t){0};
     return list;
 }
 
-static void add_package(package_list_t *list, const char *name, const char *version) {
-    if (!list || !name) return;
+// Get the bucket holding a package, or the empty bucket where it would go
+static int find_package_bucket(package_list_t *list, const char *name) {
+    int mask = list->bucket_count - 1;
+    int bucket = hash_bytes(HASH_INIT, name, strlen(name)) & mask;
+
+    while (list->buckets[bucket] >= 0) {
+        if (strcmp(list->items[list->buckets[bucket]].name, name) == 0)
+            break;
+        bucket = (bucket + 1) & mask;
+    }
+
+    return bucket;
+}
+
+// Double the index size and insert all the items again
+static int grow_package_buckets(package_list_t *list) {
+    int bucket_count = list->bucket_count * 2;
+    int *buckets = malloc(bucket_count * sizeof(int));
+    if (!buckets) return -1;
+    memset(buckets, 0xff, bucket_count * sizeof(int));
+
+    free(list->buckets);
+    list->buckets = buckets;
+    list->bucket_count = bucket_count;
 
-    // Check for duplicates
     for (int i = 0; i < list->count; i++) {
-        if (strcmp(list->items[i].name, name) == 0) {
-            return; // Already exists
-        }
+        list->buckets[find_package_bucket(list, list->items[i].name)] = i;
+    }
+
+    return 0;
+}
+
+// Add a package unless it's already there, returns its index or -1
+static int add_package(package_list_t *list, const char *name, const char *version) {
+    if (!list || !name) return -1;
+
+    // Check for duplicates
+    int bucket = find_package_bucket(list, name);
+    if (list->buckets[bucket] >= 0) {
+        return list->buckets[bucket]; // Already exists
     }
 
     // Expand capacity if needed
     if (list->count >= list->capacity) {
         list->capacity *= 2;
         list->items = realloc(list->items, list->capacity * sizeof(package_t));
-        if (!list->items) return;
+        if (!list->items) return -1;
     }
 
-    list->items[list->count].name = strdup(name);
-    list->items[list->count].version = version ? strdup(version) : NULL;
+    char *name_copy = arena_strdup(&list->strings, name);
+    if (!name_copy) return -1;
+
+    int index = list->count;
+    list->items[index].name = name_copy;
+    list->items[index].version = version ? arena_strdup(&list->strings, version) : NULL;
+    list->items[index].confidence = -1;
+    list->buckets[bucket] = index;
     list->count++;
+
+    // Keep the index at most half full
+    if (list->count * 2 > list->bucket_count)
+        grow_package_buckets(list);
+
+    return index;
 }
 
 void free_package_list(package_list_t *list) {
     if (!list) return;
 
-    for (int i = 0; i < list->count; i++) {
-        free(list->items[i].name);
-        if (list->items[i].version) {
-            free(list->items[i].version);
-        }
-    }
+    arena_free(&list->strings);
     free(list->items);
+    free(list->buckets);
     free(list);
 }
 
-// Execute command via SSH and return output
-static char* execute_ssh_command(const char *host, const char *command) {
-    if (config.debug)
-        printf("ddn:execute_ssh_command(): (subdir) running '%s'\n", command);
-    
-    char ssh_cmd[MAX_CMD_LEN + 1024];
-    snprintf(ssh_cmd, sizeof(ssh_cmd), "ssh %s -- %s 2>/dev/null",
-             host, command);
-
-    FILE *pipe = popen(ssh_cmd, "r");
-    if (!pipe) return NULL;
-
-    char *output = malloc(MAX_OUTPUT_LEN);
-    if (!output) {
-        pclose(pipe);
-        return NULL;
-    }
-
-    size_t len = fread(output, 1, MAX_OUTPUT_LEN - 1, pipe);
-    output[len] = '\0';
-
-    pclose(pipe);
-    return output;
-}
-
-// Get VM hostname for a distro from environment variable
+// Get the VM, container or root directory of a distro from environment variable,
+// followed by its replicas if any
 static char* get_vm_host(const char *distro_name) {
     char env_var[128];
     snprintf(env_var, sizeof(env_var), "DISTRO_VM_%s", distro_name);
@@ -97,148 +136,1313 @@ static char* get_vm_host(const char *distro_name) {
     return host ? strdup(host) : NULL;
 }
 
-// Map header file to library name (simple heuristic)
-static const char* header_to_library(const char *header) {
-    // Common mappings
-    if (strstr(header, "ssl.h")) return "ssl";
-    if (strstr(header, "crypto.h")) return "ssl";
-    if (strstr(header, "curl.h")) return "curl";
-    if (strstr(header, "pthread.h")) return "c";
-    if (strstr(header, "z.h")) return "z";
-    if (strstr(header, "sqlite3.h")) return "sqlite3";
-    if (strstr(header, "mysql.h")) return "mysqlclient";
-    if (strstr(header, "postgres.h") || strstr(header, "pq")) return "pq";
-    if (strstr(header, "pcre.h")) return "pcre";
-    if (strstr(header, "xml2.h")) return "xml2";
-    if (strstr(header, "json.h")) return "json-c";
-    if (strstr(header, "readline.h")) return "readline";
-    if (strstr(header, "ncurses.h")) return "ncurses";
-    if (strstr(header, "pcap.h")) return "pcap";
-    if (strstr(header, "jansson.h")) return "jansson";
-    if (strstr(header, "stdio.h")) return "c";
-    if (strstr(header, "stdlib.h")) return "c";
-    if (strstr(header, "unistd.h")) return "c";
-
-    return NULL;
-}
-
-// Query package for a specific dependency
-static void query_dependency(const char *host, const distro_info_t *distro,
-                            dependency_t *dep, package_list_t *packages) {
-    char command[MAX_CMD_LEN];
-    const char *lib_name = NULL;
-
-    if (dep->type == DEP_TYPE_HEADER) {
-        lib_name = header_to_library(dep->name);
-        if (!lib_name) {
-            // Try to extract library name from header path
-            char *last_slash = strrchr(dep->name, '/');
-            char *base_name = last_slash ? last_slash + 1 : (char*)dep->name;
-
-            // Remove .h extension
-            char *dot = strrchr(base_name, '.');
-            if (dot) {
-                size_t len = dot - base_name;
-                char *tmp = malloc(len + 1);
-                strncpy(tmp, base_name, len);
-                tmp[len] = '\0';
-                lib_name = tmp;
-            }
+// Connections kept open with --serve, one per DISTRO_VM_<name> value
+typedef struct {
+    char *host;
+    backend_t *backend;
+} kept_backend_t;
+
+static pthread_mutex_t kept_lock = PTHREAD_MUTEX_INITIALIZER;
+static kept_backend_t *kept_backends;
+static int kept_count;
+
+// Connect to a distro's system. A server reuses the connections of the
+// previous requests, so that they don't pay for the SSH handshake again.
+static backend_t* open_backend(const char *host) {
+    if (!config.serve) return backend_open(host);
+
+    pthread_mutex_lock(&kept_lock);
+    backend_t *backend = NULL;
+    for (int i = 0; i < kept_count && !backend; i++) {
+        if (strcmp(kept_backends[i].host, host) == 0) backend = kept_backends[i].backend;
+    }
+
+    if (!backend && (backend = backend_open(host))) {
+        kept_backend_t *tmp = realloc(kept_backends, (kept_count + 1) * sizeof(kept_backend_t));
+        char *copy = strdup(host);
+        if (tmp && copy) {
+            kept_backends = tmp;
+            kept_backends[kept_count].host = copy;
+            kept_backends[kept_count].backend = backend;
+            kept_count++;
+        } else {
+            if (tmp) kept_backends = tmp;
+            free(copy);
+            backend_close(backend);
+            backend = NULL;
         }
-    } else {
-        lib_name = dep->name;
     }
+    pthread_mutex_unlock(&kept_lock);
 
-    if (!lib_name) return;
+    return backend;
+}
+
+static void close_backend(backend_t *backend) {
+    if (!config.serve) backend_close(backend);
+}
+
+// Connect to the hosts of a DISTRO_VM_<name> value, a comma-separated list of
+// hosts serving the same distro. Returns the number of hosts connected to.
+static int open_remote(const char *hosts, remote_t *remote) {
+    char *copy = strdup(hosts);
+    if (!copy) return 0;
+
+    char *saveptr = NULL;
+    char *host = strtok_r(copy, HOST_SEPARATORS, &saveptr);
+    while (host && remote->count < REMOTE_MAX_HOSTS) {
+        backend_t *backend = open_backend(host);
+        if (backend) remote->hosts[remote->count++] = backend;
+        host = strtok_r(NULL, HOST_SEPARATORS, &saveptr);
+    }
+    free(copy);
+
+    return remote->count;
+}
+
+static void close_remote(remote_t *remote) {
+    for (int i = 0; i < remote->count; i++) {
+        close_backend(remote->hosts[i]);
+    }
+    remote->count = 0;
+}
+
+void close_kept_backends(void) {
+    pthread_mutex_lock(&kept_lock);
+    for (int i = 0; i < kept_count; i++) {
+        backend_close(kept_backends[i].backend);
+        free(kept_backends[i].host);
+    }
+    free(kept_backends);
+    kept_backends = NULL;
+    kept_count = 0;
+    pthread_mutex_unlock(&kept_lock);
+}
+
+// Whether a dependency is resolved by asking which package owns its file
+// rather than by a name search. pkg-config modules always are where the
+// package manager can tell, headers and libraries only with --exact.
+// Alpine can't look files up beyond pkg-config provides, Gentoo needs e-file.
+static int use_owner_query(const distro_info_t *distro, dependency_type_t type) {
+    if (type == DEP_TYPE_PKGCONFIG)
+        return distro->type != DISTRO_GENTOO || config.exact;
+    return config.exact && distro->type != DISTRO_ALPINE;
+}
+
+// Get the name to search the package manager for, NULL if there's nothing to query
+static char* get_query_name(const distro_info_t *distro, const dependency_t *dep) {
+    if (dep->type != DEP_TYPE_HEADER || use_owner_query(distro, dep->type))
+        return strdup(dep->name);
+
+    const char *lib_name;
+    switch (mapping_lookup(dep->name, &lib_name)) {
+        case MAPPING_LIBRARY: return strdup(lib_name);
+        case MAPPING_SYSTEM: return NULL;
+        case MAPPING_NONE: break;
+    }
+
+    // Try to extract library name from header path
+    const char *last_slash = strrchr(dep->name, '/');
+    const char *base_name = last_slash ? last_slash + 1 : dep->name;
+
+    // Remove .h extension
+    const char *dot = strrchr(base_name, '.');
+    if (!dot) return NULL;
+
+    return strndup(base_name, dot - base_name);
+}
+
+// Escape a name to match it literally in an extended regex
+static void escape_regex(const char *name, char *escaped, size_t size) {
+    size_t len = 0;
+    for (const char *p = name; *p && len + 2 < size; p++) {
+        if (strchr(".+*?()[]{}|^$\\", *p)) escaped[len++] = '\\';
+        escaped[len++] = *p;
+    }
+    escaped[len] = '\0';
+}
+
+// Get the pattern and command asking which package owns the file of a
+// dependency: the header under /usr/include, lib<name>.so or <name>.pc
+static int get_owner_query(const distro_info_t *distro, dependency_type_t type, const char *name,
+                           char *pattern, size_t size, const char **format) {
+    char escaped[MAX_CMD_LEN / 4];
+
+    switch (distro->type) {
+        case DISTRO_DEBIAN:
+        case DISTRO_UBUNTU:
+            // "<package>: <path>", apt-file -x takes a regex
+            escape_regex(name, escaped, sizeof(escaped));
+            *format = "apt-file search -x %s";
+            if (type == DEP_TYPE_HEADER)
+                snprintf(pattern, size, "^/usr/include/([^/]*-linux-[^/]*/)?%s$", escaped);
+            else if (type == DEP_TYPE_LIBRARY)
+                snprintf(pattern, size, "^/usr/lib/(.*/)?lib%s\\.(so|a)$", escaped);
+            else
+                snprintf(pattern, size, "/pkgconfig/%s\\.pc$", escaped);
+            return 0;
+
+        case DISTRO_ARCH:
+            *format = "pacman -Fq %s";
+            if (type == DEP_TYPE_HEADER)
+                snprintf(pattern, size, "/usr/include/%s", name);
+            else if (type == DEP_TYPE_LIBRARY)
+                snprintf(pattern, size, "/usr/lib/lib%s.so", name);
+            else
+                snprintf(pattern, size, "%s.pc", name);
+            return 0;
+
+        case DISTRO_ALPINE:
+            if (type != DEP_TYPE_PKGCONFIG) return -1;
+            *format = "apk search -v %s";
+            snprintf(pattern, size, "pc:%s", name);
+            return 0;
+
+        case DISTRO_FEDORA:
+        case DISTRO_OPENSUSE:
+            if (distro->type == DISTRO_FEDORA)
+                *format = "dnf -C repoquery --qf '%%{name}\\n' --whatprovides %s";
+            else
+                *format = "zypper --quiet search --provides --match-exact -t package %s";
+            if (type == DEP_TYPE_HEADER)
+                snprintf(pattern, size, "/usr/include/%s", name);
+            else if (type == DEP_TYPE_LIBRARY)
+                snprintf(pattern, size, "/usr/lib64/lib%s.so", name);
+            else
+                snprintf(pattern, size, "pkgconfig(%s)", name);
+            return 0;
+
+        case DISTRO_GENTOO:
+            *format = "e-file %s";
+            if (type == DEP_TYPE_HEADER)
+                snprintf(pattern, size, "/usr/include/%s", name);
+            else if (type == DEP_TYPE_LIBRARY)
+                snprintf(pattern, size, "lib%s.so", name);
+            else
+                snprintf(pattern, size, "%s.pc", name);
+            return 0;
+
+        default:
+            return -1;
+    }
+}
+
+// Command dumping every package the name searches of a distro look at, in the
+// format of the searches' output. NULL for the distros whose searches don't
+// load the whole repository metadata each time.
+static const char* warm_up_command(const distro_info_t *distro) {
+    switch (distro->type) {
+        case DISTRO_DEBIAN:
+        case DISTRO_UBUNTU:
+            // "<name> - <description>"
+            return "apt-cache search --names-only .";
+
+        case DISTRO_FEDORA:
+            // "<name>.<arch> : <summary>"
+            return "dnf -C repoquery --qf '%{name}.%{arch} : %{summary}\\n'";
+
+        case DISTRO_OPENSUSE:
+            // "<status> | <name> | <summary> | package"
+            return "zypper --quiet search -t package";
+
+        default:
+            return NULL;
+    }
+}
+
+// Turn a name search into a grep of the warm-up dump, which gives the lines
+// the package manager would have printed in milliseconds. Hosts without the
+// dump, replicas among them, still run the package manager.
+static void use_warm_up_dump(const distro_info_t *distro, const char *name, const char *dump_path,
+                             char *command, size_t size) {
+    char escaped[MAX_CMD_LEN / 4];
+    char pattern[MAX_CMD_LEN / 2];
+    const char *grep;
+
+    escape_regex(name, escaped, sizeof(escaped));
+    switch (distro->type) {
+        case DISTRO_DEBIAN:
+        case DISTRO_UBUNTU:
+            // The apt-cache regex, on the name only
+            grep = "grep -iE";
+            snprintf(pattern, sizeof(pattern), "^[^ ]*lib%s[^ ]*-dev[^ ]* ", escaped);
+            break;
+
+        case DISTRO_FEDORA:
+            grep = "grep -F";
+            snprintf(pattern, sizeof(pattern), "%s-devel.x86_64", name);
+            break;
+
+        case DISTRO_OPENSUSE:
+            // A substring of the name column
+            grep = "grep -iE";
+            snprintf(pattern, sizeof(pattern), "^[^|]*\\|[^|]*lib%s", escaped);
+            break;
+
+        default:
+            return;
+    }
+
+    char *quoted_pattern = shell_quote(pattern);
+    char *quoted_path = shell_quote(dump_path);
+    char warm[MAX_CMD_LEN];
+    if (quoted_pattern && quoted_path &&
+        snprintf(warm, sizeof(warm), "if [ -s %s ]; then %s %s %s; else %s; fi", quoted_path,
+                 grep, quoted_pattern, quoted_path, command) < (int)sizeof(warm))
+        snprintf(command, size, "%s", warm);
+    free(quoted_pattern);
+    free(quoted_path);
+}
+
+// Build the package search command for a dependency, only the package manager
+// runs on the target and its output is filtered by add_query_line(). Name
+// searches read the warm-up dump at 'dump_path' when given.
+// Returns 0 on success or -1 if there's nothing to query.
+static int build_query_command(const distro_info_t *distro, dependency_type_t type,
+                               const char *name, const char *dump_path, char *command,
+                               size_t size) {
+    char pattern[MAX_CMD_LEN / 2];
+    const char *format;
+
+    if (use_owner_query(distro, type)) {
+        if (get_owner_query(distro, type, name, pattern, sizeof(pattern), &format) != 0)
+            return -1;
+        char *quoted = shell_quote(pattern);
+        if (!quoted) return -1;
+        snprintf(command, size, format, quoted);
+        free(quoted);
+        return 0;
+    }
 
     // Build query command based on distro
     switch (distro->type) {
         case DISTRO_DEBIAN:
         case DISTRO_UBUNTU:
-            // Try pkg-config first, then search for lib*-dev packages
-            snprintf(command, sizeof(command),
-                    "apt-cache search --names-only 'lib%s.*-dev' | head -5 | cut -d' ' -f1",
-                    lib_name);
+            // Search for lib*-dev packages
+            format = "apt-cache search --names-only %s";
+            snprintf(pattern, sizeof(pattern), "lib%s.*-dev", name);
             break;
 
         case DISTRO_ARCH:
-            snprintf(command, sizeof(command),
-                    "pacman -Ss '^%s$' | grep -v '^ ' | cut -d'/' -f2 | cut -d' ' -f1",
-                    lib_name);
+            format = "pacman -Ss %s";
+            snprintf(pattern, sizeof(pattern), "^%s$", name);
             break;
 
         case DISTRO_ALPINE:
-            snprintf(command, sizeof(command),
-                    "apk search -v %s-dev | cut -d'-' -f1-2",
-                    lib_name);
+            format = "apk search -v %s";
+            snprintf(pattern, sizeof(pattern), "%s-dev", name);
             break;
 
         case DISTRO_FEDORA:
-            snprintf(command, sizeof(command),
-                    "dnf -C search %s-devel | grep '%s-devel.x86_64' | sed 's/\\.x86_64//g' | awk '{ print $1 }'",
-                    lib_name, lib_name);
+            format = "dnf -C search %s";
+            snprintf(pattern, sizeof(pattern), "%s-devel", name);
             break;
 
         case DISTRO_GENTOO:
-            snprintf(command, sizeof(command),
-                    "emerge -s '^%s$' | grep -A1 'Latest version' | tail -1 | awk '{print $1}'",
-                    lib_name);
+            format = "emerge -s %s";
+            snprintf(pattern, sizeof(pattern), "^%s$", name);
             break;
 
         case DISTRO_OPENSUSE:
-            snprintf(command, sizeof(command),
-                    "zypper search --match-substrings -t package 'lib%s' | awk '/-devel/ { print $2 }'",
-                    lib_name);
+            format = "zypper search --match-substrings -t package %s";
+            snprintf(pattern, sizeof(pattern), "lib%s", name);
             break;
 
         default:
+            return -1;
+    }
+
+    // Names come from the sources, nothing in them may reach the shell
+    char *quoted = shell_quote(pattern);
+    if (!quoted) return -1;
+    snprintf(command, size, format, quoted);
+    free(quoted);
+
+    if (dump_path) use_warm_up_dump(distro, name, dump_path, command, size);
+
+    return 0;
+}
+
+// Output of one dependency's query being filtered
+typedef struct {
+    const distro_info_t *distro;
+    dependency_type_t type;
+    char *name;                 // Name searched for
+    package_list_t *packages;
+    int lines;
+    int after_latest;           // Gentoo: the previous line was "Latest version"
+    int complete;               // Batch: the block's status line arrived, or it had no block
+    char latest[256];
+} query_output_t;
+
+// Copy the nth whitespace-separated field of a line, like awk's $n
+static void get_field(const char *line, int n, char *field, size_t size) {
+    field[0] = '\0';
+    for (int i = 1; *line; i++) {
+        while (*line == ' ' || *line == '\t') line++;
+        size_t len = strcspn(line, " \t");
+        if (len == 0) return;
+        if (i == n) {
+            snprintf(field, size, "%.*s", (int)len, line);
             return;
+        }
+        line += len;
+    }
+}
+
+static void add_package_name(query_output_t *output, const char *name) {
+    if (*name) add_package(output->packages, name, NULL);
+}
+
+// Pick package names out of the output of a file owner query
+static void add_owner_query_line(query_output_t *output, char *line) {
+    char field[256];
+    char *p;
+
+    switch (output->distro->type) {
+        case DISTRO_DEBIAN:
+        case DISTRO_UBUNTU:
+            // "<name>: <path>"
+            p = strchr(line, ':');
+            if (!p) return;
+            *p = '\0';
+            add_package_name(output, line);
+            break;
+
+        case DISTRO_ARCH:
+            // "<repo>/<name>"
+            p = strchr(line, '/');
+            get_field(p ? p + 1 : line, 1, field, sizeof(field));
+            add_package_name(output, field);
+            break;
+
+        case DISTRO_ALPINE:
+            // "<name>-<version>-r<n> - <description>"
+            get_field(line, 1, field, sizeof(field));
+            p = strrchr(field, '-');
+            if (p && p[1] == 'r') {
+                *p = '\0';
+                p = strrchr(field, '-');
+                if (p) *p = '\0';
+            }
+            add_package_name(output, field);
+            break;
+
+        case DISTRO_FEDORA:
+            // "<name>", metadata messages have more words
+            get_field(line, 2, field, sizeof(field));
+            if (field[0]) return;
+            get_field(line, 1, field, sizeof(field));
+            add_package_name(output, field);
+            break;
+
+        case DISTRO_OPENSUSE:
+            // "<status> | <name> | <summary> | package"
+            p = strchr(line, '|');
+            if (!p) return;
+            get_field(p + 1, 1, field, sizeof(field));
+            if (strcmp(field, "Name") != 0 && strcmp(field, "|") != 0)
+                add_package_name(output, field);
+            break;
+
+        case DISTRO_GENTOO:
+            // " * <category>/<name>" or "[I] <category>/<name>", details are indented
+            get_field(line, 1, field, sizeof(field));
+            if (strcmp(field, "*") != 0 && strcmp(field, "[I]") != 0) return;
+            get_field(line, 2, field, sizeof(field));
+            if (strchr(field, '/')) add_package_name(output, field);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Pick package names out of a line of package manager output
+static void add_query_line(char *line, void *arg) {
+    query_output_t *output = arg;
+    char field[256];
+    char needle[300];
+    char *p;
+
+    if (use_owner_query(output->distro, output->type)) {
+        add_owner_query_line(output, line);
+        return;
+    }
+
+    switch (output->distro->type) {
+        case DISTRO_DEBIAN:
+        case DISTRO_UBUNTU:
+            // "<name> - <description>", the first few only
+            if (output->lines++ >= APT_MAX_RESULTS) return;
+            get_field(line, 1, field, sizeof(field));
+            add_package_name(output, field);
+            break;
+
+        case DISTRO_ARCH:
+            // "<repo>/<name> <version>" followed by an indented description
+            if (line[0] == ' ') return;
+            p = strchr(line, '/');
+            get_field(p ? p + 1 : line, 1, field, sizeof(field));
+            add_package_name(output, field);
+            break;
+
+        case DISTRO_ALPINE:
+            // "<name>-dev-<version> - <description>", up to the second dash
+            p = strchr(line, '-');
+            if (p) p = strchr(p + 1, '-');
+            if (p) *p = '\0';
+            get_field(line, 1, field, sizeof(field));
+            add_package_name(output, field);
+            break;
+
+        case DISTRO_FEDORA:
+            // "<name>-devel.x86_64 : <summary>"
+            snprintf(needle, sizeof(needle), "%s-devel.x86_64", output->name);
+            if (!strstr(line, needle)) return;
+            get_field(line, 1, field, sizeof(field));
+            p = strstr(field, ".x86_64");
+            if (p) *p = '\0';
+            add_package_name(output, field);
+            break;
+
+        case DISTRO_GENTOO:
+            // The line after the last "Latest version"
+            if (output->after_latest) {
+                get_field(line, 1, output->latest, sizeof(output->latest));
+                output->after_latest = 0;
+            }
+            if (strstr(line, "Latest version")) output->after_latest = 1;
+            break;
+
+        case DISTRO_OPENSUSE:
+            // "  | <name>-devel | <summary> | package"
+            if (!strstr(line, "-devel")) return;
+            get_field(line, 2, field, sizeof(field));
+            add_package_name(output, field);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Add what's only known once the output is complete
+static void finish_query_output(query_output_t *output) {
+    if (output->distro->type == DISTRO_GENTOO)
+        add_package_name(output, output->latest);
+}
+
+// Warn about commands that couldn't run at all, a package manager
+// finding nothing isn't a failure. 125 is a container or chroot error,
+// 126 and 127 a command that can't be run and 255 an SSH error.
+// Commands the distro's deadline left no time for are counted by the caller.
+static remote_failure_t report_failure(const distro_info_t *distro, const char *what, int status,
+                                       char *errors) {
+    remote_failure_t failure = remote_failure(status);
+    if (errors) errors[strcspn(errors, "\n")] = '\0';
+
+    switch (failure) {
+        case REMOTE_OK:
+        case REMOTE_DEADLINE:
+            break;
+        case REMOTE_TIMEOUT:
+            fprintf(stderr, "Warning: %s: %s timed out\n", distro->name, what);
+            break;
+        case REMOTE_CONNECTION:
+        case REMOTE_COMMAND:
+            fprintf(stderr, "Warning: %s: %s failed (exit status %d)%s%s\n", distro->name, what,
+                    status, errors ? ": " : "", errors ? errors : "");
+            break;
+    }
+
+    free(errors);
+    return failure;
+}
+
+// Query package for a specific dependency, returns why it failed if it did
+static remote_failure_t query_dependency(remote_t *remote, const distro_info_t *distro,
+                                         const char *dump_path, dependency_t *dep,
+                                         package_list_t *packages) {
+    query_output_t output = { .distro = distro, .type = dep->type, .packages = packages };
+    output.name = get_query_name(distro, dep);
+    if (!output.name) return REMOTE_OK;
+
+    remote_failure_t failure = REMOTE_OK;
+    char command[MAX_CMD_LEN];
+    if (build_query_command(distro, dep->type, output.name, dump_path, command,
+                            sizeof(command)) == 0) {
+        char *errors;
+        int status = remote_run(remote, command, add_query_line, &output, &errors);
+        finish_query_output(&output);
+        failure = report_failure(distro, dep->name, status, errors);
+    }
+
+    free(output.name);
+    return failure;
+}
+
+// Keep the first line of output
+static void first_line(char *line, void *arg) {
+    char **output = arg;
+    if (!*output) *output = strdup(line);
+}
+
+// Get a fingerprint of the distro's repository metadata,
+// it changes whenever the package lists get updated
+static char* fetch_repo_fingerprint(remote_t *remote, const distro_info_t *distro) {
+    char command[MAX_CMD_LEN];
+    snprintf(command, sizeof(command), "stat -c '%%n %%s %%Y' %s 2>/dev/null | cksum",
+             distro->metadata_paths);
+
+    char *output = NULL;
+    remote_run(remote, command, first_line, &output, NULL);
+    if (!output) return NULL;
+
+    // "<crc> <size>", keep it as a single word
+    unsigned long crc, size;
+    char *fingerprint = NULL;
+    if (sscanf(output, "%lu %lu", &crc, &size) == 2) {
+        if (asprintf(&fingerprint, "%lx-%lx", crc, size) < 0) fingerprint = NULL;
+    }
+
+    free(output);
+    return fingerprint;
+}
+
+char* format_package_string(package_list_t *packages) {
+    size_t len = 1;
+    for (int i = 0; packages && i < packages->count; i++) {
+        len += strlen(packages->items[i].name) + 5;
+    }
+
+    char *value = malloc(len);
+    if (!value) return NULL;
+
+    char *p = value;
+    for (int i = 0; packages && i < packages->count; i++) {
+        if (i > 0) *p++ = ' ';
+        size_t name_len = strlen(packages->items[i].name);
+        memcpy(p, packages->items[i].name, name_len);
+        p += name_len;
+        if (packages->items[i].confidence >= 0)
+            p += sprintf(p, "=%d", packages->items[i].confidence);
+    }
+    *p = '\0';
+
+    return value;
+}
+
+// Fill a package list from a cache entry
+void add_package_string(package_list_t *packages, const char *str) {
+    char *copy = strdup(str);
+    if (!copy) return;
+
+    char *saveptr = NULL;
+    char *name = strtok_r(copy, " ", &saveptr);
+    while (name) {
+        char *confidence = strchr(name, '=');
+        if (confidence) *confidence++ = '\0';
+        int index = add_package(packages, name, NULL);
+        if (index >= 0 && confidence)
+            packages->items[index].confidence = atoi(confidence);
+        name = strtok_r(NULL, " ", &saveptr);
+    }
+    free(copy);
+}
+
+static int is_dev_package(const char *name) {
+    size_t len = strlen(name);
+    return (len > 4 && strcmp(name + len - 4, "-dev") == 0) ||
+           (len > 6 && strcmp(name + len - 6, "-devel") == 0);
+}
+
+// With --exact, keep a single package for a dependency and rate it.
+// Owners of the dependency's file are sure when there's only one, the
+// first result of a name search is a guess. Among several candidates,
+// development packages win and the others don't count.
+static void pick_package(const char *distro_name, const dependency_t *dep,
+                         package_list_t *candidates, int owner) {
+    if (!config.exact || !candidates || candidates->count == 0) return;
+
+    // Cached entries were picked already
+    if (candidates->count == 1 && candidates->items[0].confidence >= 0) return;
+
+    int best = -1;
+    int dev_count = 0;
+    for (int i = 0; i < candidates->count; i++) {
+        if (is_dev_package(candidates->items[i].name)) {
+            if (best < 0) best = i;
+            dev_count++;
+        }
     }
+    if (best < 0) best = 0;
+    int choices = dev_count ? dev_count : candidates->count;
 
-    char *output = execute_ssh_command(host, command);
-    if (output) {
-        // Parse output line by line
-        char *line = strtok(output, "\n");
-        while (line) {
-            // Trim whitespace
-            while (*line && (*line == ' ' || *line == '\t')) line++;
-            if (*line) {
-                add_package(packages, line, NULL);
+    package_list_t *picked = create_package_list();
+    if (!picked) return;
+    int index = add_package(picked, candidates->items[best].name, candidates->items[best].version);
+    if (index < 0) {
+        free_package_list(picked);
+        return;
+    }
+    picked->items[index].confidence = (owner ? 100 : 50) / choices;
+
+    if (config.debug)
+        printf("ddn:pick_package(): %s: '%s' -> '%s' (%d%%, %d candidates)\n", distro_name,
+               dep->name, picked->items[index].name, picked->items[index].confidence,
+               candidates->count);
+
+    package_list_t tmp = *candidates;
+    *candidates = *picked;
+    *picked = tmp;
+    free_package_list(picked);
+}
+
+// Part of the dependencies sent as one remote script
+typedef struct {
+    char *script;
+    int start;
+    int end;
+} batch_t;
+
+// State shared by the workers querying one distro,
+// each worker only writes to the package lists of its own dependencies
+typedef struct {
+    remote_t remote;
+    const distro_info_t *distro;
+    dependency_list_t *deps;
+    package_list_t **dep_packages;
+    remote_failure_t *failures;     // Why the query of each dependency failed
+    char *dump_path;            // Package list dumped by the warm-up, NULL without
+    int *pending;               // Indexes of the dependencies that need a query
+    int pending_count;
+    batch_t *batches;
+    int batch_count;
+    query_output_t *outputs;    // Output filter of each pending dependency
+} distro_query_t;
+
+static void query_dependency_worker(int index, void *arg) {
+    distro_query_t *query = arg;
+    int dep_index = query->pending[index];
+    query->failures[dep_index] = query_dependency(&query->remote, query->distro, query->dump_path,
+                                                  &query->deps->items[dep_index],
+                                                  query->dep_packages[dep_index]);
+}
+
+// Output of one remote script being sorted
+typedef struct {
+    distro_query_t *query;
+    batch_t *batch;
+    int current;                // Position in the pending list of the current block
+} batch_output_t;
+
+static void add_batch_line(char *line, void *arg) {
+    batch_output_t *output = arg;
+
+    // Tags hold the position in the pending list
+    if (strncmp(line, BATCH_TAG, strlen(BATCH_TAG)) == 0) {
+        output->current = atoi(line + strlen(BATCH_TAG));
+        if (output->current < output->batch->start || output->current >= output->batch->end)
+            output->current = -1;
+        return;
+    }
+    if (output->current < 0) return;
+
+    // Status lines hold the exit status of the block's command, they follow
+    // the last line of output when it had no newline
+    distro_query_t *query = output->query;
+    char *status = strstr(line, BATCH_STATUS_TAG);
+    if (status) *status = '\0';
+    if (line[0] || !status) add_query_line(line, &query->outputs[output->current]);
+    if (!status) return;
+
+    int dep_index = query->pending[output->current];
+    query->outputs[output->current].complete = 1;
+    remote_failure_t failure = report_failure(query->distro, query->deps->items[dep_index].name,
+                                              atoi(status + strlen(BATCH_STATUS_TAG)), NULL);
+    if (failure) query->failures[dep_index] = failure;
+    output->current = -1;
+}
+
+// Run one remote script and sort the tagged output lines
+// back into each dependency's package list
+static void run_batch_worker(int index, void *arg) {
+    distro_query_t *query = arg;
+    batch_output_t output = { query, &query->batches[index], -1 };
+
+    char *errors;
+    int status = remote_run(&query->remote, output.batch->script, add_batch_line, &output, &errors);
+    remote_failure_t failure = report_failure(query->distro, "batch query", status, errors);
+
+    // Scripts end with a status line, so only a broken connection or shell
+    // makes them fail. The blocks that didn't get to their end fail with it.
+    int incomplete = 0;
+    for (int i = output.batch->start; i < output.batch->end; i++) {
+        if (query->outputs[i].complete) continue;
+        query->failures[query->pending[i]] = failure ? failure : REMOTE_CONNECTION;
+        incomplete++;
+    }
+    if (incomplete && !failure)
+        fprintf(stderr, "Warning: %s: batch query ended early (exit status %d)\n",
+                query->distro->name, status);
+}
+
+// Fail the dependencies from position 'start' of the pending list, which no
+// script could be made for. They're not cached, the next run asks again.
+static void fail_unbatched(distro_query_t *query, int start) {
+    if (start >= query->pending_count) return;
+
+    fprintf(stderr, "Warning: %s: out of memory, %d queries not run\n", query->distro->name,
+            query->pending_count - start);
+    for (int i = start; i < query->pending_count; i++) {
+        query->failures[query->pending[i]] = REMOTE_COMMAND;
+    }
+}
+
+// Query all dependencies with as few remote round trips as possible:
+// every lookup goes into one script, each result block preceded by a tag line
+// and followed by the exit status of its command.
+// With several jobs the dependencies are split in as many scripts running at once.
+static void query_dependencies_batch(distro_query_t *query, int jobs) {
+    dependency_list_t *deps = query->deps;
+    int count = query->pending_count;
+    int per_batch = jobs > 1 ? (count + jobs - 1) / jobs : count;
+
+    // Remote command lines have a size limit, so huge batches are cut further
+    size_t script_capacity = BATCH_MAX_SCRIPT + MAX_CMD_LEN + 128;
+    int batch_capacity = jobs > 1 ? jobs : 1;
+    query->batches = calloc(batch_capacity, sizeof(batch_t));
+    query->outputs = calloc(count, sizeof(query_output_t));
+    if (!query->batches || !query->outputs) {
+        free(query->batches);
+        free(query->outputs);
+        fail_unbatched(query, 0);
+        return;
+    }
+
+    batch_t *batch = NULL;
+    size_t script_len = 0;
+    int batched;
+    for (batched = 0; batched < count; batched++) {
+        int i = batched;
+        if (!batch || script_len >= BATCH_MAX_SCRIPT || i - batch->start >= per_batch) {
+            if (query->batch_count >= batch_capacity) {
+                batch_capacity *= 2;
+                batch_t *tmp = realloc(query->batches, batch_capacity * sizeof(batch_t));
+                if (!tmp) break;
+                query->batches = tmp;
             }
-            line = strtok(NULL, "\n");
+
+            batch = &query->batches[query->batch_count];
+            batch->script = malloc(script_capacity);
+            if (!batch->script) break;
+            batch->script[0] = '\0';
+            batch->start = i;
+            query->batch_count++;
+            script_len = 0;
+        }
+
+        char command[MAX_CMD_LEN];
+        query_output_t *output = &query->outputs[i];
+        output->distro = query->distro;
+        output->packages = query->dep_packages[query->pending[i]];
+        output->type = deps->items[query->pending[i]].type;
+        output->name = get_query_name(query->distro, &deps->items[query->pending[i]]);
+        if (output->name &&
+            build_query_command(query->distro, output->type, output->name, query->dump_path,
+                                command, sizeof(command)) == 0) {
+            script_len += snprintf(batch->script + script_len, script_capacity - script_len,
+                                   "echo '%s%d'; %s; echo \"%s$?\"\n", BATCH_TAG, i, command,
+                                   BATCH_STATUS_TAG);
+        } else {
+            output->complete = 1;
         }
+        batch->end = i + 1;
+    }
+
+    fail_unbatched(query, batched);
+
+    pool_run(query->batch_count, jobs, run_batch_worker, query);
+
+    for (int i = 0; i < query->batch_count; i++) {
+        free(query->batches[i].script);
+    }
+    free(query->batches);
+
+    for (int i = 0; i < batched; i++) {
+        finish_query_output(&query->outputs[i]);
+        free(query->outputs[i].name);
+    }
+    free(query->outputs);
+}
+
+// Load the repository metadata once for all the name searches of a distro
+// rather than once per search: the package list goes to a temporary file on
+// the first host, that the searches grep instead. Sets the file's path, left
+// NULL when there's nothing worth warming up or the dump failed.
+static void warm_up(distro_query_t *query) {
+    const distro_info_t *distro = query->distro;
+    const char *dump = warm_up_command(distro);
+    if (!config.warm_up || !dump) return;
+
+    // Headers mapped to the system or without a name to search for don't count
+    int searches = 0;
+    for (int i = 0; i < query->pending_count; i++) {
+        const dependency_t *dep = &query->deps->items[query->pending[i]];
+        if (use_owner_query(distro, dep->type)) continue;
+        char *name = get_query_name(distro, dep);
+        if (name) searches++;
+        free(name);
+    }
+    if (searches < WARM_UP_MIN_SEARCHES) return;
+
+    char command[MAX_CMD_LEN];
+    snprintf(command, sizeof(command),
+             "f=$(mktemp -t ddn-warm.XXXXXX) && "
+             "{ %s > \"$f\" && [ -s \"$f\" ] && echo \"$f\" || { rm -f \"$f\"; exit 1; }; }", dump);
+
+    // Not hedged, the dump has to be on the host the searches go to first
+    remote_t first = { .hosts = { query->remote.hosts[0] }, .count = 1,
+                       .deadline = query->remote.deadline };
+    long long start = stats_begin();
+    char *path = NULL, *errors;
+    int status = remote_run(&first, command, first_line, &path, &errors);
+    stats_end(SPAN_WARMUP, start, distro->name);
+
+    if (status == 0 && path && path[0] == '/') {
+        if (config.debug)
+            printf("ddn:warm_up(): %s: package list dumped to '%s' for %d searches\n", distro->name,
+                   path, searches);
+        query->dump_path = path;
+    } else {
+        free(path);
+    }
+    report_failure(distro, "warm-up", status, errors);
+}
+
+// Remove the warm-up dump. It gets a few seconds of its own, the distro's
+// deadline may be over when its queries timed out.
+static void cool_down(distro_query_t *query) {
+    if (!query->dump_path) return;
+
+    char *quoted = shell_quote(query->dump_path);
+    char command[MAX_CMD_LEN];
+    if (quoted && snprintf(command, sizeof(command), "rm -f %s", quoted) < (int)sizeof(command)) {
+        remote_t first = { .hosts = { query->remote.hosts[0] }, .count = 1,
+                           .deadline = stats_now() + COOL_DOWN_TIMEOUT * NS_PER_SEC };
+        char *output = NULL;
+        remote_run(&first, command, first_line, &output, NULL);
         free(output);
     }
+    free(quoted);
+    free(query->dump_path);
+    query->dump_path = NULL;
 }
 
-package_list_t* query_distro_packages(const char *distro_name, dependency_list_t *deps) {
-    if (!distro_name || !deps) return NULL;
+// Resolve the dependencies from the local index, the cache and the VM
+static void resolve_dependencies(const distro_info_t *distro, distro_query_t *query,
+                                 resolution_source_t *sources) {
+    const char *distro_name = distro->name;
+    dependency_list_t *deps = query->deps;
 
-    printf("Querying %s packages...\n", distro_name);
+    // Every command of the distro ends by this deadline, queries it
+    // doesn't leave time for fail rather than make the run wait
+    if (config.distro_timeout > 0)
+        query->remote.deadline = stats_now() + config.distro_timeout * NS_PER_SEC;
 
-    // Get VM host
-    char *host = get_vm_host(distro_name);
-    if (!host) {
+    // A local index resolves dependencies without any VM
+    int *unresolved = malloc(deps->count * sizeof(int));
+    int unresolved_count = 0;
+    if (!unresolved) return;
+    package_index_t *index = index_open(distro_name);
+    for (int i = 0; i < deps->count; i++) {
+        const char *found[INDEX_MAX_MATCHES];
+        int count = index_lookup(index, &deps->items[i], found, INDEX_MAX_MATCHES);
+        for (int j = 0; j < count; j++) {
+            add_package(query->dep_packages[i], found[j], NULL);
+        }
+        if (count == 0) {
+            unresolved[unresolved_count++] = i;
+        } else {
+            pick_package(distro_name, &deps->items[i], query->dep_packages[i], 1);
+            sources[i] = RESOLVED_INDEX;
+            stats_add(STAT_INDEX_HITS, 1);
+        }
+    }
+    index_close(index);
+
+    if (config.offline) {
+        if (!index)
+            fprintf(stderr, "Warning: No index for %s (run 'distro-dep-name index build -d %s')\n",
+                    distro_name, distro_name);
+        unresolved_count = 0;
+    }
+
+    char *host = unresolved_count > 0 ? get_vm_host(distro_name) : NULL;
+    resolution_cache_t *cache = config.no_cache || unresolved_count == 0 ? NULL : cache_open(distro_name);
+
+    // Recently checked cache entries are used without contacting the VM,
+    // otherwise the entries are only kept if the repositories didn't change
+    if (cache && !cache_is_fresh(cache) && host) {
+        if (open_remote(host, &query->remote) > 0) {
+            char *fingerprint = fetch_repo_fingerprint(&query->remote, distro);
+            cache_set_fingerprint(cache, fingerprint);
+            free(fingerprint);
+        }
+    }
+
+    int use_cache = cache_is_fresh(cache);
+    for (int j = 0; j < unresolved_count; j++) {
+        int i = unresolved[j];
+        const char *cached = use_cache ? cache_lookup(cache, &deps->items[i]) : NULL;
+        if (cached) {
+            if (config.debug)
+                printf("ddn:resolve_dependencies(): %s: cache hit for '%s'\n",
+                       distro_name, deps->items[i].name);
+            add_package_string(query->dep_packages[i], cached);
+            sources[i] = RESOLVED_CACHE;
+            stats_add(STAT_CACHE_HITS, 1);
+        } else {
+            query->pending[query->pending_count++] = i;
+        }
+    }
+    free(unresolved);
+
+    if (query->pending_count > 0 && !host) {
         fprintf(stderr, "Warning: No VM configured for %s (set DISTRO_VM_%s environment variable)\n",
                 distro_name, distro_name);
-        return create_package_list();
+    } else if (query->pending_count > 0) {
+        // One connection per host for all the queries of this distro
+        if (query->remote.count == 0)
+            open_remote(host, &query->remote);
+
+        if (query->remote.count > 0) {
+            warm_up(query);
+            if (config.batch) {
+                query_dependencies_batch(query, config.jobs);
+            } else {
+                // Query each dependency
+                pool_run(query->pending_count, config.jobs, query_dependency_worker, query);
+            }
+            cool_down(query);
+        } else {
+            fprintf(stderr, "Warning: %s: cannot connect to '%s'\n", distro_name, host);
+            for (int i = 0; i < query->pending_count; i++) {
+                query->failures[query->pending[i]] = REMOTE_CONNECTION;
+            }
+        }
+
+        // Failures aren't cached, the next run asks again
+        int not_run = 0;
+        for (int i = 0; i < query->pending_count; i++) {
+            int dep_index = query->pending[i];
+            dependency_t *dep = &deps->items[dep_index];
+            if (query->failures[dep_index]) {
+                sources[dep_index] = RESOLVED_FAILED;
+                if (query->failures[dep_index] == REMOTE_DEADLINE) not_run++;
+                continue;
+            }
+            pick_package(distro_name, dep, query->dep_packages[dep_index],
+                         use_owner_query(distro, dep->type));
+            sources[dep_index] = RESOLVED_QUERY;
+            if (use_cache)
+                cache_store(cache, dep, query->dep_packages[dep_index]);
+        }
+        if (not_run > 0)
+            fprintf(stderr, "Warning: %s: %d queries not run, --distro-timeout of %lds reached\n",
+                    distro_name, not_run, config.distro_timeout);
     }
 
+    close_remote(&query->remote);
+    free(host);
+
+    if (cache) {
+        if (cache_save(cache) != 0)
+            fprintf(stderr, "Warning: cannot write cache file '%s'\n", cache->path);
+        cache_close(cache);
+    }
+}
+
+package_list_t* query_distro_packages(const char *distro_name, dependency_list_t *deps,
+                                      resolution_details_t *details) {
+    if (!distro_name || !deps) return NULL;
+
+    if (!config.serve)
+        fprintf(progress_stream(), "Querying %s packages...\n", distro_name);
+
     // Get distro info
     const distro_info_t *distro = get_distro_by_name(distro_name);
     if (!distro) {
         fprintf(stderr, "Error: Unknown distro %s\n", distro_name);
-        free(host);
         return create_package_list();
     }
 
+    long long start = stats_now();
     package_list_t *packages = create_package_list();
 
-    // Query each dependency
+    distro_query_t query = { .distro = distro, .deps = deps };
+    query.dep_packages = calloc(deps->count, sizeof(package_list_t*));
+    query.pending = malloc(deps->count * sizeof(int));
+    query.failures = calloc(deps->count, sizeof(remote_failure_t));
+    resolution_source_t *sources = calloc(deps->count, sizeof(resolution_source_t));
+    if (!query.dep_packages || !query.pending || !query.failures || !sources) {
+        free(query.dep_packages);
+        free(query.pending);
+        free(query.failures);
+        free(sources);
+        return packages;
+    }
     for (int i = 0; i < deps->count; i++) {
-        query_dependency(host, distro, &deps->items[i], packages);
+        query.dep_packages[i] = create_package_list();
     }
 
-    free(host);
+    // A running server resolves for every client at once
+    if (config.serve ||
+        server_resolve(distro_name, deps, query.dep_packages, sources, query.failures) != 0)
+        resolve_dependencies(distro, &query, sources);
+
+    // Merge in dependency order so that the output stays stable
+    for (int i = 0; i < deps->count; i++) {
+        package_list_t *dep_packages = query.dep_packages[i];
+        if (!dep_packages) continue;
+        for (int j = 0; j < dep_packages->count; j++) {
+            package_t *package = &dep_packages->items[j];
+            int index = add_package(packages, package->name, package->version);
+
+            // A package resolving several dependencies is as sure as the least sure one
+            if (index >= 0 && package->confidence >= 0 &&
+                (packages->items[index].confidence < 0 ||
+                 package->confidence < packages->items[index].confidence))
+                packages->items[index].confidence = package->confidence;
+        }
+        if (!details) free_package_list(dep_packages);
+    }
+    free(query.pending);
+
+    if (details) {
+        details->packages = query.dep_packages;
+        details->sources = sources;
+        details->failures = query.failures;
+        details->count = deps->count;
+        details->elapsed = stats_now() - start;
+    } else {
+        free(query.dep_packages);
+        free(query.failures);
+        free(sources);
+    }
+
+    stats_end(SPAN_DISTRO, start, distro_name);
     return packages;
 }
+
+void free_resolution_details(resolution_details_t *details) {
+    if (!details) return;
+
+    for (int i = 0; i < details->count; i++) {
+        free_package_list(details->packages[i]);
+    }
+    free(details->packages);
+    free(details->sources);
+    free(details->failures);
+    memset(details, 0, sizeof(resolution_details_t));
+}
+
+// Command dumping the header, library and pkg-config files of every package
+static const char* index_dump_command(const distro_info_t *distro) {
+    switch (distro->type) {
+        case DISTRO_DEBIAN:
+        case DISTRO_UBUNTU:
+            // "<package>: <path>"
+            return "apt-file search -x "
+                   "'^/usr/(include/|lib/(.*/)?lib[^/]*\\.(so|a)$|(lib|share)/(.*/)?pkgconfig/[^/]*\\.pc$)'";
+
+        case DISTRO_ARCH:
+            // "<package> <path>"
+            return "pacman -Fl "
+                   "| grep -E ' usr/(include/.*[^/]$|lib/lib[^/]*\\.(so|a)$|(lib|share)/pkgconfig/[^/]*\\.pc$)'";
+
+        case DISTRO_ALPINE:
+            // Installed packages' files and every package's so: and pc: provides,
+            // as "P:<package>", "F:<dir>", "R:<file>" and "p:<provides>" lines
+            return "{ cat /lib/apk/db/installed; "
+                   "for f in /var/cache/apk/APKINDEX.*.tar.gz; do tar -xzOf \"$f\" APKINDEX; done; } "
+                   "| grep -E '^[PpFR]:'";
+
+        case DISTRO_FEDORA:
+            // "<package>: <path>" followed by the package's other paths, one per line
+            return "dnf -C repoquery --qf '%{name}: %{files}' "
+                   "| grep -E '^[^/]|^/usr/(include/|lib(64)?/lib[^/]*\\.(so|a)$|(lib(64)?|share)/pkgconfig/[^/]*\\.pc$)'";
+
+        case DISTRO_GENTOO:
+            // Installed packages only, "<category>/<package>-<version> <path>"
+            return "for f in /var/db/pkg/*/*/CONTENTS; do p=${f#/var/db/pkg/}; "
+                   "awk -v p=\"${p%/CONTENTS}\" '$1 == \"obj\" || $1 == \"sym\" { print p, $2 }' \"$f\"; done "
+                   "| grep -E ' /usr/(include/|lib(64)?/lib[^/]*\\.(so|a)$|(lib(64)?|share)/pkgconfig/[^/]*\\.pc$)'";
+
+        case DISTRO_OPENSUSE:
+            // Repository file lists, "<package ... name=\"<package>\"" and "<file><path></file>" lines
+            return "for f in /var/cache/zypp/raw/*/repodata/*filelists.xml*; do "
+                   "case \"$f\" in *.zst) zstdcat \"$f\";; *) zcat -f \"$f\";; esac; done "
+                   "| grep -E '<package |<file>/usr/(include/|lib(64)?/lib[^/]*\\.(so|a)<|(lib(64)?|share)/pkgconfig/[^/]*\\.pc<)'";
+
+        default:
+            return NULL;
+    }
+}
+
+// Index being built from the dump output
+typedef struct {
+    index_builder_t *builder;
+    const distro_info_t *distro;
+    long lines;
+    char package[256];          // Package being listed in multi-line dump formats
+    char dir[1024];
+} index_dump_state_t;
+
+// Strip the version from a gentoo "<category>/<package>-<version>[-r<n>]" atom
+static void strip_gentoo_version(char *atom) {
+    char *dash = strrchr(atom, '-');
+    if (dash && dash[1] == 'r' && dash[2] >= '0' && dash[2] <= '9') {
+        *dash = '\0';
+        dash = strrchr(atom, '-');
+    }
+    if (dash && dash[1] >= '0' && dash[1] <= '9') *dash = '\0';
+}
+
+// Add one line of dump output to the index
+static void add_index_line(char *line, void *arg) {
+    index_dump_state_t *state = arg;
+    index_builder_t *builder = state->builder;
+    const distro_info_t *distro = state->distro;
+    char *sep;
+
+    state->lines++;
+
+    switch (distro->type) {
+        case DISTRO_DEBIAN:
+        case DISTRO_UBUNTU:
+            sep = strstr(line, ": ");
+            if (!sep) return;
+            *sep = '\0';
+            index_builder_add_file(builder, line, sep + 2);
+            break;
+
+        case DISTRO_ARCH:
+        case DISTRO_GENTOO:
+            sep = strchr(line, ' ');
+            if (!sep) return;
+            *sep = '\0';
+            if (distro->type == DISTRO_GENTOO) strip_gentoo_version(line);
+            index_builder_add_file(builder, line, sep + 1);
+            break;
+
+        case DISTRO_ALPINE:
+            if (line[0] == '\0' || line[1] != ':') return;
+            if (line[0] == 'P') {
+                snprintf(state->package, sizeof(state->package), "%s", line + 2);
+            } else if (line[0] == 'F') {
+                snprintf(state->dir, sizeof(state->dir), "%s", line + 2);
+            } else if (line[0] == 'R' && state->package[0]) {
+                char path[2048];
+                snprintf(path, sizeof(path), "%s/%s", state->dir, line + 2);
+                index_builder_add_file(builder, state->package, path);
+            } else if (line[0] == 'p' && state->package[0]) {
+                char *saveptr = NULL;
+                char *provides = strtok_r(line + 2, " ", &saveptr);
+                while (provides) {
+                    if (strncmp(provides, "so:", 3) == 0) {
+                        char *eq = strchr(provides, '=');
+                        if (eq) *eq = '\0';
+                        index_builder_add_soname(builder, state->package, provides + 3);
+                    } else if (strncmp(provides, "pc:", 3) == 0) {
+                        char *eq = strchr(provides, '=');
+                        if (eq) *eq = '\0';
+                        index_builder_add_pkgconfig(builder, state->package, provides + 3);
+                    }
+                    provides = strtok_r(NULL, " ", &saveptr);
+                }
+            }
+            break;
+
+        case DISTRO_FEDORA:
+            if (line[0] == '/') {
+                if (state->package[0])
+                    index_builder_add_file(builder, state->package, line);
+                return;
+            }
+            sep = strstr(line, ": ");
+            if (!sep) return;
+            *sep = '\0';
+            snprintf(state->package, sizeof(state->package), "%s", line);
+            index_builder_add_file(builder, state->package, sep + 2);
+            break;
+
+        case DISTRO_OPENSUSE:
+            if ((sep = strstr(line, "<package "))) {
+                char *name = strstr(sep, " name=\"");
+                if (!name) return;
+                name += 7;
+                char *end = strchr(name, '"');
+                if (!end) return;
+                *end = '\0';
+                snprintf(state->package, sizeof(state->package), "%s", name);
+            } else if ((sep = strstr(line, "<file>")) && state->package[0]) {
+                char *path = sep + 6;
+                char *end = strstr(path, "</file>");
+                if (end) *end = '\0';
+                index_builder_add_file(builder, state->package, path);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+int build_distro_index(const char *distro_name) {
+    if (!distro_name) return -1;
+
+    const distro_info_t *distro = get_distro_by_name(distro_name);
+    if (!distro) {
+        fprintf(stderr, "Error: Unknown distro %s\n", distro_name);
+        return -1;
+    }
+
+    char *host = get_vm_host(distro_name);
+    if (!host) {
+        fprintf(stderr, "Error: No VM configured for %s (set DISTRO_VM_%s environment variable)\n",
+                distro_name, distro_name);
+        return -1;
+    }
+
+    printf("Building %s index...\n", distro_name);
+
+    // Dumps are made on the first host, replicas have the same packages
+    host[strcspn(host, HOST_SEPARATORS)] = '\0';
+    backend_t *backend = backend_open(host);
+    free(host);
+    if (!backend) return -1;
+
+    index_builder_t *builder = index_builder_create();
+    if (!builder) {
+        backend_close(backend);
+        return -1;
+    }
+
+    // File lists run to hundreds of megabytes, they're indexed as they arrive
+    index_dump_state_t state = { .builder = builder, .distro = distro };
+    char *errors;
+    int status = backend_run(backend, index_dump_command(distro), add_index_line, &state, &errors);
+    report_failure(distro, "file list dump", status, errors);
+    backend_close(backend);
+
+    if (state.lines == 0) {
+        fprintf(stderr, "Error: %s: no file list received from the VM\n", distro_name);
+        index_builder_free(builder);
+        return -1;
+    }
+
+    int ret = index_builder_save(builder, distro_name);
+    index_builder_free(builder);
+    return ret;
+}
@@ -2,20 +2,63 @@
 #define VM_QUERY_H 1
 
 #include "parser.h"
+#include "arena.h"
+#include "remote.h"
 
 typedef struct {
     char *name;
     char *version;
+    int confidence;     // 0-100 with --exact, -1 when not rated
 } package_t;
 
 typedef struct {
     package_t *items;
     int count;
     int capacity;
+    int *buckets;       // Open-addressing index of items, -1 when empty
+    int bucket_count;   // Power of two, at least twice the item count
+    arena_t strings;    // Item names and versions
 } package_list_t;
 
-// Query a distro's VMs for packages that provide the dependencies
-package_list_t* query_distro_packages(const char *distro_name, dependency_list_t *deps);
+// Where the packages of a dependency came from
+typedef enum {
+    RESOLVED_NONE,      // Not resolved
+    RESOLVED_INDEX,     // Local index
+    RESOLVED_CACHE,     // Resolution cache
+    RESOLVED_QUERY,     // Package manager on the VM
+    RESOLVED_FAILED     // The query failed, see the failure
+} resolution_source_t;
+
+// How each dependency of a distro got resolved
+typedef struct {
+    package_list_t **packages;      // Packages of each dependency, in dependency order
+    resolution_source_t *sources;
+    remote_failure_t *failures;     // Why the failed queries failed
+    int count;
+    long long elapsed;              // Nanoseconds spent on the distro
+} resolution_details_t;
+
+// Query a distro's VMs for packages that provide the dependencies.
+// 'details' may be NULL, otherwise it gets the packages of each dependency.
+package_list_t* query_distro_packages(const char *distro_name, dependency_list_t *deps,
+                                      resolution_details_t *details);
+
+// Free what query_distro_packages() put in 'details'
+void free_resolution_details(resolution_details_t *details);
+
+// Packages as stored in the cache and sent by the server: space-separated names,
+// each followed by "=<confidence>" when rated. The result must be freed.
+char* format_package_string(package_list_t *packages);
+
+// Add the packages of such a string to a list
+void add_package_string(package_list_t *packages, const char *str);
+
+// Close the connections a server kept open
+void close_kept_backends(void);
+
+// Dump a distro's header and library file lists from its VM into a local index,
+// returns 0 on success
+int build_distro_index(const char *distro_name);
 
 // Free package list
 void free_package_list(package_list_t *list);
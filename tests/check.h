@@ -0,0 +1,46 @@
+#ifndef CHECK_H
+#define CHECK_H 1
+
+#include <stdio.h>
+#include <string.h>
+
+// Minimal checks for the test programs: failures are reported with their
+// line and counted, check_done() gives the exit status
+
+static int check_count;
+static int check_failures;
+
+#define CHECK(cond) do { \
+    check_count++; \
+    if (!(cond)) { \
+        check_failures++; \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+    } \
+} while (0)
+
+#define CHECK_INT(actual, expected) do { \
+    long long check_a = (actual), check_e = (expected); \
+    check_count++; \
+    if (check_a != check_e) { \
+        check_failures++; \
+        fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, \
+                check_a, check_e); \
+    } \
+} while (0)
+
+#define CHECK_STR(actual, expected) do { \
+    const char *check_a = (actual), *check_e = (expected); \
+    check_count++; \
+    if (!check_a || strcmp(check_a, check_e) != 0) { \
+        check_failures++; \
+        fprintf(stderr, "%s:%d: %s is '%s', expected '%s'\n", __FILE__, __LINE__, #actual, \
+                check_a ? check_a : "(null)", check_e); \
+    } \
+} while (0)
+
+static int check_done(const char *name) {
+    printf("%-16s %d checks, %d failed\n", name, check_count, check_failures);
+    return check_failures ? 1 : 0;
+}
+
+#endif // CHECK_H
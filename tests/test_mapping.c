@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ddn_config.h"
+#include "mapping.h"
+#include "check.h"
+
+config_t config;
+
+// Library a header maps to, "-" for system headers and "?" without a rule
+static const char* lookup(const char *header) {
+    const char *library = NULL;
+    switch (mapping_lookup(header, &library)) {
+        case MAPPING_LIBRARY: return library;
+        case MAPPING_SYSTEM: return "-";
+        case MAPPING_NONE: break;
+    }
+    return "?";
+}
+
+static int write_rules(const char *path, const char *rules) {
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    fputs(rules, f);
+    return fclose(f);
+}
+
+int main(void) {
+    char dir[] = "/tmp/ddn-test-XXXXXX";
+    CHECK(mkdtemp(dir) != NULL);
+    char rules_path[64], bad_path[64];
+    snprintf(rules_path, sizeof(rules_path), "%s/rules.txt", dir);
+    snprintf(bad_path, sizeof(bad_path), "%s/bad.txt", dir);
+
+    // Built-in rules: exact names, prefixes in the forward trie and
+    // suffixes in the backward one
+    CHECK_INT(mapping_init(NULL), 0);
+    uint64_t builtin_hash = mapping_hash();
+    CHECK_STR(lookup("zlib.h"), "z");
+    CHECK_STR(lookup("openssl/ssl.h"), "ssl");
+    CHECK_STR(lookup("openssl/evp/deep.h"), "ssl");
+    CHECK_STR(lookup("GL/glu.h"), "gl");
+    CHECK_STR(lookup("sys/capability.h"), "cap");
+    CHECK_STR(lookup("sys/wait.h"), "-");
+    CHECK_STR(lookup("sys/platform/x86.h"), "-");
+    CHECK_STR(lookup("stdio.h"), "-");
+    CHECK_STR(lookup("immintrin.h"), "-");
+    CHECK_STR(lookup("vector"), "-");
+    CHECK_STR(lookup("sys/sdt.h"), "?");
+    CHECK_STR(lookup("libfoo.h"), "?");
+    CHECK_STR(lookup("zlib.hpp"), "?");
+    CHECK_STR(lookup("openssl"), "?");
+    CHECK_STR(lookup(""), "?");
+
+    // Rules files add rules and replace built-in ones of the same kind
+    CHECK_INT(write_rules(rules_path,
+                          "# comment\n"
+                          "exact   zlib.h          zng      # replaces z\n"
+                          "exact   GL/glu.h        glu\n"
+                          "prefix  foo/            foo\n"
+                          "prefix  foo/bar/        foobar\n"
+                          "suffix  _private.h      -\n"
+                          "suffix  _config.h       cfg\n"
+                          "suffix  x_config.h      xcfg\n"), 0);
+    CHECK_INT(mapping_init(rules_path), 0);
+    CHECK(mapping_hash() != builtin_hash);
+    CHECK_STR(lookup("zlib.h"), "zng");
+    CHECK_STR(lookup("zconf.h"), "z");
+
+    // An exact rule wins over a prefix, the longest prefix wins
+    CHECK_STR(lookup("GL/glu.h"), "glu");
+    CHECK_STR(lookup("GL/gl.h"), "gl");
+    CHECK_STR(lookup("foo/a.h"), "foo");
+    CHECK_STR(lookup("foo/bar/b.h"), "foobar");
+    CHECK_STR(lookup("foo/barb.h"), "foo");
+
+    // A prefix wins over a suffix, the longest suffix wins
+    CHECK_STR(lookup("foo/x_config.h"), "foo");
+    CHECK_STR(lookup("lib_config.h"), "cfg");
+    CHECK_STR(lookup("libx_config.h"), "xcfg");
+    CHECK_STR(lookup("a/b/lib_private.h"), "-");
+    CHECK_STR(lookup("_config.h"), "cfg");
+    CHECK_STR(lookup("config.h"), "?");
+
+    // Same rules, same hash
+    uint64_t file_hash = mapping_hash();
+    CHECK_INT(mapping_init(rules_path), 0);
+    CHECK(mapping_hash() == file_hash);
+
+    // Malformed lines are refused
+    CHECK_INT(write_rules(bad_path, "exact zlib.h\n"), 0);
+    CHECK(mapping_init(bad_path) != 0);
+    CHECK_INT(write_rules(bad_path, "middle zlib.h z\n"), 0);
+    CHECK(mapping_init(bad_path) != 0);
+    CHECK(mapping_init("/nonexistent/rules.txt") != 0);
+
+    mapping_free();
+    unlink(rules_path);
+    unlink(bad_path);
+    rmdir(dir);
+    return check_done("mapping");
+}
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ddn_config.h"
+#include "pkgindex.h"
+#include "check.h"
+
+config_t config;
+
+#define HEADER_COUNT 500
+
+// Packages found for a dependency, joined with spaces
+static const char* lookup(package_index_t *index, dependency_type_t type, const char *name) {
+    static char result[256];
+    dependency_t dep = { .name = (char*)name, .type = type };
+    const char *packages[8];
+    int count = index_lookup(index, &dep, packages, 8);
+
+    result[0] = '\0';
+    for (int i = 0; i < count; i++) {
+        if (i > 0) strcat(result, " ");
+        strncat(result, packages[i], sizeof(result) - strlen(result) - 2);
+    }
+    return result;
+}
+
+int main(void) {
+    char dir[] = "/tmp/ddn-test-XXXXXX";
+    CHECK(mkdtemp(dir) != NULL);
+    config.index_dir = dir;
+
+    // No index yet
+    CHECK(index_open("test") == NULL);
+
+    index_builder_t *builder = index_builder_create();
+    CHECK(builder != NULL);
+    if (!builder) return check_done("pkgindex");
+
+    // Enough keys sharing long prefixes to span many front-coded blocks
+    char path[128], package[64];
+    for (int i = 0; i < HEADER_COUNT; i++) {
+        snprintf(path, sizeof(path), "/usr/include/many/header%04d.h", i);
+        snprintf(package, sizeof(package), "libmany%d-dev", i % 7);
+        index_builder_add_file(builder, package, path);
+    }
+
+    index_builder_add_file(builder, "zlib1g-dev", "/usr/include/zlib.h");
+    index_builder_add_file(builder, "zlib1g-dev", "/usr/include/zlib.h");
+    index_builder_add_file(builder, "libcurl4-openssl-dev", "/usr/include/x86_64-linux-gnu/curl/curl.h");
+    index_builder_add_file(builder, "libcurl4-gnutls-dev", "/usr/include/x86_64-linux-gnu/curl/curl.h");
+    index_builder_add_file(builder, "zlib1g-dev", "/usr/lib/x86_64-linux-gnu/libz.so");
+    index_builder_add_file(builder, "zlib1g-dev", "/usr/lib/x86_64-linux-gnu/libz.a");
+    index_builder_add_file(builder, "zlib1g-dev", "/usr/lib/x86_64-linux-gnu/pkgconfig/zlib.pc");
+    index_builder_add_soname(builder, "libssl3", "libssl.so.3");
+    index_builder_add_pkgconfig(builder, "libssl-dev", "openssl");
+
+    // Not kept: directories, unversioned files elsewhere, stray .pc files
+    index_builder_add_file(builder, "junk", "/usr/include/dir/");
+    index_builder_add_file(builder, "junk", "/usr/share/doc/libz.so");
+    index_builder_add_file(builder, "junk", "/usr/lib/libjunk.so.1");
+    index_builder_add_file(builder, "junk", "/usr/lib/junk.pc");
+
+    CHECK_INT(index_builder_save(builder, "test"), 0);
+    index_builder_free(builder);
+
+    package_index_t *index = index_open("test");
+    CHECK(index != NULL);
+    if (!index) return check_done("pkgindex");
+
+    // Every key comes back with its package, whatever block it's in
+    int mismatches = 0;
+    for (int i = 0; i < HEADER_COUNT; i++) {
+        char name[64], expected[64];
+        snprintf(name, sizeof(name), "many/header%04d.h", i);
+        snprintf(expected, sizeof(expected), "libmany%d-dev", i % 7);
+        if (strcmp(lookup(index, DEP_TYPE_HEADER, name), expected) != 0) mismatches++;
+    }
+    CHECK_INT(mismatches, 0);
+
+    CHECK_STR(lookup(index, DEP_TYPE_HEADER, "zlib.h"), "zlib1g-dev");
+    CHECK_STR(lookup(index, DEP_TYPE_HEADER, "curl/curl.h"), "libcurl4-gnutls-dev libcurl4-openssl-dev");
+    CHECK_STR(lookup(index, DEP_TYPE_LIBRARY, "z"), "zlib1g-dev");
+    CHECK_STR(lookup(index, DEP_TYPE_LIBRARY, "ssl"), "libssl3");
+    CHECK_STR(lookup(index, DEP_TYPE_PKGCONFIG, "zlib"), "zlib1g-dev");
+    CHECK_STR(lookup(index, DEP_TYPE_PKGCONFIG, "openssl"), "libssl-dev");
+
+    // Misses before, between and after the keys, and other types
+    CHECK_STR(lookup(index, DEP_TYPE_HEADER, "aaa.h"), "");
+    CHECK_STR(lookup(index, DEP_TYPE_HEADER, "many/header0100"), "");
+    CHECK_STR(lookup(index, DEP_TYPE_HEADER, "many/header0100.hh"), "");
+    CHECK_STR(lookup(index, DEP_TYPE_HEADER, "many/header9999.h"), "");
+    CHECK_STR(lookup(index, DEP_TYPE_HEADER, "zzz.h"), "");
+    CHECK_STR(lookup(index, DEP_TYPE_LIBRARY, "zlib.h"), "");
+    CHECK_STR(lookup(index, DEP_TYPE_LIBRARY, "junk"), "");
+    CHECK_STR(lookup(index, DEP_TYPE_PKGCONFIG, "junk"), "");
+    CHECK_STR(lookup(index, DEP_TYPE_HEADER, "dir/"), "");
+
+    // The matches stop at 'max'
+    dependency_t curl = { .name = "curl/curl.h", .type = DEP_TYPE_HEADER };
+    const char *one[1];
+    CHECK_INT(index_lookup(index, &curl, one, 1), 1);
+
+    index_close(index);
+
+    // Files that aren't an index are refused
+    char *index_file = index_path("test");
+    FILE *f = index_file ? fopen(index_file, "w") : NULL;
+    CHECK(f != NULL);
+    if (f) {
+        fputs("not an index\n", f);
+        fclose(f);
+    }
+    CHECK(index_open("test") == NULL);
+
+    unlink(index_file);
+    free(index_file);
+    rmdir(dir);
+    return check_done("pkgindex");
+}
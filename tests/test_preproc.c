@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "ddn_config.h"
+#include "preproc.h"
+#include "check.h"
+
+config_t config;
+
+// Status at the end of a file made of these directives, without the '#'
+static dependency_status_t status_after(preproc_state_t *state, const char **directives) {
+    preproc_state_reset(state);
+    for (int i = 0; directives[i]; i++) {
+        preproc_directive(state, directives[i], directives[i] + strlen(directives[i]));
+    }
+    return preproc_status(state);
+}
+
+#define STATUS(...) status_after(state, (const char*[]){ __VA_ARGS__, NULL })
+
+int main(void) {
+    preproc_init();
+    preproc_state_t *state = preproc_state_create();
+    CHECK(state != NULL);
+    if (!state) return check_done("preproc");
+
+    // Plain values
+    CHECK_INT(STATUS("if 1"), DEP_REQUIRED);
+    CHECK_INT(STATUS("if 0"), DEP_EXCLUDED);
+    CHECK_INT(STATUS("if 2 * 3 == 6 && 7 % 4 == 3"), DEP_REQUIRED);
+    CHECK_INT(STATUS("if (1 << 4) > 15 ? 0 : 1"), DEP_EXCLUDED);
+    CHECK_INT(STATUS("if 'a' == 97"), DEP_REQUIRED);
+
+    // Macros of the target: known, known to be missing, or unknown
+    CHECK_INT(STATUS("ifdef __linux__"), DEP_REQUIRED);
+    CHECK_INT(STATUS("if __CHAR_BIT__ == 8"), DEP_REQUIRED);
+    CHECK_INT(STATUS("ifdef _WIN32"), DEP_EXCLUDED);
+    CHECK_INT(STATUS("ifndef __APPLE__"), DEP_REQUIRED);
+    CHECK_INT(STATUS("ifdef USE_FOO"), DEP_OPTIONAL);
+    CHECK_INT(STATUS("if FOO_LEVEL > 2"), DEP_OPTIONAL);
+    CHECK_INT(STATUS("if __GNUC__ >= 4"), DEP_OPTIONAL);
+    CHECK_INT(STATUS("if __has_include(<maybe.h>)"), DEP_OPTIONAL);
+
+    // Unknown operands only matter when they can change the result
+    CHECK_INT(STATUS("if defined(USE_FOO) && 0"), DEP_EXCLUDED);
+    CHECK_INT(STATUS("if defined(USE_FOO) || 1"), DEP_REQUIRED);
+    CHECK_INT(STATUS("if defined(USE_FOO) && defined(_WIN32)"), DEP_EXCLUDED);
+    CHECK_INT(STATUS("if __GNUC__ >= 4 || defined(__linux__)"), DEP_REQUIRED);
+    CHECK_INT(STATUS("if defined(USE_FOO) && FOO_LEVEL > 2 /* comment */"), DEP_OPTIONAL);
+    CHECK_INT(STATUS("if !defined(USE_FOO)"), DEP_OPTIONAL);
+
+    // Other branches
+    CHECK_INT(STATUS("if 0", "else"), DEP_REQUIRED);
+    CHECK_INT(STATUS("if 1", "else"), DEP_EXCLUDED);
+    CHECK_INT(STATUS("ifdef USE_FOO", "else"), DEP_OPTIONAL);
+    CHECK_INT(STATUS("if 0", "elif 1"), DEP_REQUIRED);
+    CHECK_INT(STATUS("if 1", "elif USE_FOO"), DEP_EXCLUDED);
+    CHECK_INT(STATUS("ifdef _WIN32", "elifdef __linux__"), DEP_REQUIRED);
+    CHECK_INT(STATUS("ifdef USE_FOO", "elif 1", "else"), DEP_EXCLUDED);
+    CHECK_INT(STATUS("ifdef USE_FOO", "elif 0", "else"), DEP_OPTIONAL);
+
+    // Nested blocks, and back out of them
+    CHECK_INT(STATUS("if 0", "if 1"), DEP_EXCLUDED);
+    CHECK_INT(STATUS("ifdef USE_FOO", "if 1"), DEP_OPTIONAL);
+    CHECK_INT(STATUS("ifdef USE_FOO", "if 0"), DEP_EXCLUDED);
+    CHECK_INT(STATUS("if 0", "endif"), DEP_REQUIRED);
+    CHECK_INT(STATUS("endif"), DEP_REQUIRED);
+
+    // Macros of the file itself, forgotten with the next file
+    CHECK_INT(STATUS("define LOCAL 3", "if LOCAL == 3"), DEP_REQUIRED);
+    CHECK_INT(STATUS("define LOCAL 3", "if LOCAL == 4"), DEP_EXCLUDED);
+    CHECK_INT(STATUS("define LOCAL 3", "undef LOCAL", "ifdef LOCAL"), DEP_EXCLUDED);
+    CHECK_INT(STATUS("ifdef LOCAL"), DEP_OPTIONAL);
+
+    // An include guard is always compiled, another first #ifndef isn't
+    CHECK_INT(STATUS("ifndef FOO_H", "define FOO_H"), DEP_REQUIRED);
+    CHECK_INT(STATUS("ifndef FOO_H", "define BAR"), DEP_OPTIONAL);
+
+    // Macros given for every file, the fixed ones win
+    preproc_define("HAVE_SSL", 0);
+    preproc_define("FOO_LEVEL=3", 0);
+    CHECK_INT(STATUS("ifdef HAVE_SSL"), DEP_REQUIRED);
+    CHECK_INT(STATUS("if FOO_LEVEL > 2"), DEP_REQUIRED);
+    preproc_undefine("NO_SSL", 1);
+    preproc_define("NO_SSL", 0);
+    CHECK_INT(STATUS("ifdef NO_SSL"), DEP_EXCLUDED);
+
+    // Other macros, other hash
+    uint64_t hash = preproc_hash();
+    preproc_define("EXTRA=1", 0);
+    CHECK(preproc_hash() != hash);
+
+    preproc_state_free(state);
+    preproc_free();
+    return check_done("preproc");
+}
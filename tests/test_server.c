@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "ddn_config.h"
+#include "mapping.h"
+#include "server.h"
+#include "stats.h"
+#include "check.h"
+
+config_t config;
+
+// Stands in for apt-cache on the local:// backend, "lib<name>-dev" for every search
+static const char fake_apt_cache[] =
+    "#!/bin/sh\n"
+    "name=$(echo \"$3\" | sed 's/^lib//; s/\\.\\*-dev$//')\n"
+    "echo \"lib$name-dev - fake\"\n";
+
+static char dir[] = "/tmp/ddn-test-XXXXXX";
+static char socket_path[64];
+
+static int connect_to(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Send a raw request and read the whole answer, the result must be freed
+static char* exchange(const char *request) {
+    int fd = connect_to(socket_path);
+    if (fd < 0) return strdup("(no connection)");
+
+    size_t len = strlen(request);
+    if (send(fd, request, len, MSG_NOSIGNAL) != (ssize_t)len) {
+        close(fd);
+        return strdup("(send failed)");
+    }
+
+    char *response = malloc(4096);
+    size_t used = 0;
+    ssize_t got;
+    while (response && used < 4095 && (got = recv(fd, response + used, 4095 - used, 0)) > 0) {
+        used += got;
+    }
+    if (response) response[used] = '\0';
+    close(fd);
+    return response;
+}
+
+// Request line of this build's protocol, with the given rules hash
+static void request_line(char *buffer, size_t size, const char *distro, const char *mode,
+                         unsigned long long rules, const char *body) {
+    snprintf(buffer, size, "resolve 3 %s %s %016llx\n%s\n", distro, mode, rules, body);
+}
+
+static void check_exchange(const char *request, const char *expected, int line) {
+    char *response = exchange(request);
+    check_count++;
+    if (!response || strcmp(response, expected) != 0) {
+        check_failures++;
+        fprintf(stderr, "%s:%d: answer '%s', expected '%s'\n", __FILE__, line,
+                response ? response : "(null)", expected);
+    }
+    free(response);
+}
+
+#define CHECK_EXCHANGE(request, expected) check_exchange(request, expected, __LINE__)
+
+static pid_t start_server(void) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    // As with --serve, quiet since the test prints its own results
+    config.serve = 1;
+    if (!freopen("/dev/null", "w", stderr)) _exit(1);
+    _exit(run_server());
+}
+
+static int wait_for_server(void) {
+    for (int i = 0; i < 100; i++) {
+        int fd = connect_to(socket_path);
+        if (fd >= 0) {
+            close(fd);
+            return 0;
+        }
+        struct timespec ts = { .tv_nsec = 20000000 };
+        nanosleep(&ts, NULL);
+    }
+    return -1;
+}
+
+int main(void) {
+    CHECK(mkdtemp(dir) != NULL);
+
+    char bin_dir[64], tool[96], path_env[4096];
+    snprintf(bin_dir, sizeof(bin_dir), "%s/bin", dir);
+    snprintf(tool, sizeof(tool), "%s/apt-cache", bin_dir);
+    mkdir(bin_dir, 0755);
+    FILE *f = fopen(tool, "w");
+    CHECK(f != NULL);
+    if (f) {
+        fputs(fake_apt_cache, f);
+        fclose(f);
+        chmod(tool, 0755);
+    }
+    snprintf(path_env, sizeof(path_env), "%s:%s", bin_dir, getenv("PATH") ? getenv("PATH") : "/bin");
+    setenv("PATH", path_env, 1);
+    setenv("DISTRO_VM_debian", "local://", 1);
+    setenv("XDG_CACHE_HOME", dir, 1);
+    setenv("XDG_DATA_HOME", dir, 1);
+
+    snprintf(socket_path, sizeof(socket_path), "%s/ddn.sock", dir);
+    config.socket_path = socket_path;
+    config.jobs = 2;
+    config.cache_ttl = 3600;
+    config.timeout = 10;
+    config.distro_timeout = 10;
+
+    stats_init(0, NULL);
+    CHECK_INT(mapping_init(NULL), 0);
+    unsigned long long rules = mapping_hash();
+
+    pid_t server = start_server();
+    CHECK(server > 0);
+    CHECK_INT(wait_for_server(), 0);
+
+    // Answers: one line per dependency in order, then "ok"
+    char request[512];
+    request_line(request, sizeof(request), "debian", "names", rules, "h\tzlib.h\nh\tX11/Xlib.h\n");
+    CHECK_EXCHANGE(request, "q\tlibz-dev\nq\tlibx11-dev\nok\n");
+    request_line(request, sizeof(request), "debian", "names", rules, "h\tX11/Xlib.h\n");
+    CHECK_EXCHANGE(request, "q\tlibx11-dev\nok\n");
+    request_line(request, sizeof(request), "debian", "names", rules, "");
+    CHECK_EXCHANGE(request, "ok\n");
+
+    // Requests the server can't answer
+    CHECK_EXCHANGE("hello\n\n", "error bad request\n");
+    CHECK_EXCHANGE("resolve 2 debian names\n\n", "error unsupported protocol version\n");
+    CHECK_EXCHANGE("resolve 3 debian names\n\n", "error bad request\n");
+    request_line(request, sizeof(request), "nodistro", "names", rules, "");
+    CHECK_EXCHANGE(request, "error unknown distro\n");
+    request_line(request, sizeof(request), "debian", "exact", rules, "");
+    CHECK_EXCHANGE(request, "error server runs without --exact\n");
+    request_line(request, sizeof(request), "debian", "names", rules ^ 1, "h\tzlib.h\n");
+    CHECK_EXCHANGE(request, "error server runs with other mapping rules\n");
+    request_line(request, sizeof(request), "debian", "names", rules, "zlib.h\n");
+    CHECK_EXCHANGE(request, "error bad dependency\n");
+
+    // The client side reads the same answers
+    dependency_list_t *deps = create_dependency_list();
+    add_dependency(deps, "zlib.h", DEP_TYPE_HEADER);
+    add_dependency(deps, "readline/readline.h", DEP_TYPE_HEADER);
+    resolution_source_t sources[2] = { RESOLVED_NONE, RESOLVED_NONE };
+    remote_failure_t failures[2] = { REMOTE_OK, REMOTE_OK };
+    package_list_t *packages[2] = { NULL, NULL };
+    CHECK_INT(server_resolve("debian", deps, packages, sources, failures), 0);
+    CHECK_INT(sources[0], RESOLVED_QUERY);
+    CHECK_INT(sources[1], RESOLVED_QUERY);
+
+    // Under other rules the client resolves by itself
+    char rules_path[96];
+    snprintf(rules_path, sizeof(rules_path), "%s/rules.txt", dir);
+    f = fopen(rules_path, "w");
+    if (f) {
+        fputs("exact zlib.h zng\n", f);
+        fclose(f);
+    }
+    CHECK_INT(mapping_init(rules_path), 0);
+    CHECK(server_resolve("debian", deps, packages, sources, failures) != 0);
+
+    kill(server, SIGTERM);
+    int status = -1;
+    waitpid(server, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // Nothing listening, then a server that never answers: no resolution
+    CHECK(server_resolve("debian", deps, packages, sources, failures) != 0);
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+    int silent = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    CHECK(bind(silent, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(silent, 4) == 0);
+    config.distro_timeout = 1;
+    time_t start = time(NULL);
+    CHECK(server_resolve("debian", deps, packages, sources, failures) != 0);
+    CHECK(time(NULL) - start <= 3);
+    close(silent);
+
+    free_dependency_list(deps);
+    mapping_free();
+
+    char command[128];
+    snprintf(command, sizeof(command), "rm -rf '%s'", dir);
+    if (system(command) != 0) fprintf(stderr, "cannot remove '%s'\n", dir);
+    return check_done("server");
+}